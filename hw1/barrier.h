@@ -0,0 +1,264 @@
+/* reusable barriers for a fixed group of threads with ids 0..n-1
+
+   kinds:
+	 mutex          counter under a mutex, waiters sleep on a condition variable
+	 sense          centralized sense-reversing counter, waiters spin for a
+	                while and then sleep on a futex
+	 dissemination  ceil(log2 n) rounds, in round r thread i signals thread
+	                (i + 2^r) mod n and waits for (i - 2^r) mod n
+	 tournament     pairwise arrival up a binary tree, thread 0 releases
+	                everyone through a sense-reversing flag
+
+   usage:
+	 Barrier b;
+	 barrier_init(&b, BARRIER_SENSE, n);
+	 barrier_wait(&b, myid);          in every one of the n threads
+	 barrier_destroy(&b);
+
+*/
+#ifndef BARRIER_H
+#define BARRIER_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#define BARRIER_CACHELINE 64
+#define BARRIER_MAXROUNDS 32 /* enough rounds for any int thread count */
+#define BARRIER_SPINS 4096	 /* polls before a waiter yields or sleeps */
+
+typedef enum
+{
+	BARRIER_MUTEX,
+	BARRIER_SENSE,
+	BARRIER_DISSEMINATION,
+	BARRIER_TOURNAMENT,
+	NUM_BARRIER_KINDS
+} BarrierKind;
+
+static const char *barrierNames[NUM_BARRIER_KINDS] = {"mutex", "sense", "dissemination", "tournament"};
+
+/* per thread state; nodes start on a cache line boundary and span whole
+   lines (five with the dissemination flags), so threads never share a line */
+typedef struct
+{
+	_Alignas(BARRIER_CACHELINE) atomic_int flags[2][BARRIER_MAXROUNDS]; /* dissemination signals */
+	atomic_int arrived; /* tournament arrival, holds the sense of the last arrival */
+	int sense;			/* local sense, flipped every episode */
+	int parity;			/* dissemination flag set in use */
+} BarrierNode;
+
+typedef struct
+{
+	BarrierKind kind;
+	int n;
+	int rounds; /* ceil(log2 n) */
+	int spins;	/* polls before blocking, 0 when there are more threads than CPUs */
+
+	/* mutex */
+	pthread_mutex_t lock;
+	pthread_cond_t go;
+	int numArrived;
+	unsigned long generation; /* guards the condition wait against spurious wakeups */
+
+	/* sense and tournament */
+	_Alignas(BARRIER_CACHELINE) atomic_int count;
+	_Alignas(BARRIER_CACHELINE) atomic_int sense; /* also the futex word */
+	atomic_int sleepers;
+
+	BarrierNode *nodes;
+} Barrier;
+
+static inline void barrier_pause()
+{
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#endif
+}
+
+/* wait until *word == value: spin first, then sleep on the futex, which
+   the releasing thread only wakes when someone went to sleep */
+static inline void barrier_futex_wait(Barrier *b, atomic_int *word, int value)
+{
+	for (int spin = 0; spin < b->spins; spin++)
+	{
+		if (atomic_load_explicit(word, memory_order_acquire) == value)
+			return;
+		barrier_pause();
+	}
+	atomic_fetch_add(&b->sleepers, 1);
+	while (atomic_load(word) != value)
+		syscall(SYS_futex, word, FUTEX_WAIT_PRIVATE, !value, NULL, NULL, 0);
+	atomic_fetch_sub(&b->sleepers, 1);
+}
+
+/* set the release flag and wake whoever went to sleep on it; both sides use
+   sequentially consistent accesses so a sleeper is either seen here or sees
+   the new value itself */
+static inline void barrier_futex_release(Barrier *b, atomic_int *word, int value)
+{
+	atomic_store(word, value);
+	if (atomic_load(&b->sleepers) > 0)
+		syscall(SYS_futex, word, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+}
+
+/* wait until *word == value for point to point flags: spin, then yield the CPU */
+static inline void barrier_spin_wait(Barrier *b, atomic_int *word, int value)
+{
+	for (int spin = 0; atomic_load_explicit(word, memory_order_acquire) != value; spin++)
+	{
+		if (spin < b->spins)
+			barrier_pause();
+		else
+			sched_yield();
+	}
+}
+
+static inline void barrier_init(Barrier *b, BarrierKind kind, int n)
+{
+	memset(b, 0, sizeof(*b));
+	b->kind = kind;
+	b->n = n;
+	while ((1 << b->rounds) < n)
+		b->rounds++;
+	b->spins = (n > sysconf(_SC_NPROCESSORS_ONLN)) ? 0 : BARRIER_SPINS;
+
+	pthread_mutex_init(&b->lock, NULL);
+	pthread_cond_init(&b->go, NULL);
+	atomic_init(&b->count, n);
+	atomic_init(&b->sense, 0);
+	atomic_init(&b->sleepers, 0);
+
+	b->nodes = aligned_alloc(BARRIER_CACHELINE, n * sizeof(BarrierNode));
+	memset(b->nodes, 0, n * sizeof(BarrierNode));
+	for (int i = 0; i < n; i++)
+	{
+		for (int r = 0; r < BARRIER_MAXROUNDS; r++)
+		{
+			atomic_init(&b->nodes[i].flags[0][r], 0);
+			atomic_init(&b->nodes[i].flags[1][r], 0);
+		}
+		atomic_init(&b->nodes[i].arrived, 0);
+		b->nodes[i].sense = 1;
+	}
+}
+
+static inline void barrier_destroy(Barrier *b)
+{
+	pthread_mutex_destroy(&b->lock);
+	pthread_cond_destroy(&b->go);
+	free(b->nodes);
+}
+
+static inline void barrier_wait_mutex(Barrier *b)
+{
+	pthread_mutex_lock(&b->lock);
+	unsigned long generation = b->generation;
+	b->numArrived++;
+	if (b->numArrived == b->n)
+	{
+		b->numArrived = 0;
+		b->generation++;
+		pthread_cond_broadcast(&b->go);
+	}
+	else
+	{
+		while (generation == b->generation)
+			pthread_cond_wait(&b->go, &b->lock);
+	}
+	pthread_mutex_unlock(&b->lock);
+}
+
+static inline void barrier_wait_sense(Barrier *b, BarrierNode *me)
+{
+	int sense = me->sense;
+
+	me->sense = !sense;
+	if (atomic_fetch_sub_explicit(&b->count, 1, memory_order_acq_rel) == 1)
+	{
+		atomic_store_explicit(&b->count, b->n, memory_order_relaxed);
+		barrier_futex_release(b, &b->sense, sense);
+	}
+	else
+		barrier_futex_wait(b, &b->sense, sense);
+}
+
+static inline void barrier_wait_dissemination(Barrier *b, int id)
+{
+	BarrierNode *me = &b->nodes[id];
+
+	for (int r = 0; r < b->rounds; r++)
+	{
+		BarrierNode *partner = &b->nodes[(id + (1 << r)) % b->n];
+		atomic_store_explicit(&partner->flags[me->parity][r], me->sense, memory_order_release);
+		barrier_spin_wait(b, &me->flags[me->parity][r], me->sense);
+	}
+
+	/* two flag sets alternate, the sense flips once both have been used */
+	if (me->parity == 1)
+		me->sense = !me->sense;
+	me->parity = 1 - me->parity;
+}
+
+static inline void barrier_wait_tournament(Barrier *b, int id)
+{
+	BarrierNode *me = &b->nodes[id];
+	int sense = me->sense;
+
+	me->sense = !sense;
+	for (int r = 0; r < b->rounds; r++)
+	{
+		if (id & (1 << r))
+		{
+			/* lost this round: report to the winner and wait for the release */
+			atomic_store_explicit(&me->arrived, sense, memory_order_release);
+			barrier_futex_wait(b, &b->sense, sense);
+			return;
+		}
+		if (id + (1 << r) < b->n)
+			barrier_spin_wait(b, &b->nodes[id + (1 << r)].arrived, sense);
+	}
+
+	/* only thread 0 wins every round */
+	barrier_futex_release(b, &b->sense, sense);
+}
+
+/* wait until all n threads of the group have called barrier_wait */
+static inline void barrier_wait(Barrier *b, int id)
+{
+	if (b->n <= 1)
+		return;
+	switch (b->kind)
+	{
+	case BARRIER_MUTEX:
+		barrier_wait_mutex(b);
+		break;
+	case BARRIER_SENSE:
+		barrier_wait_sense(b, &b->nodes[id]);
+		break;
+	case BARRIER_DISSEMINATION:
+		barrier_wait_dissemination(b, id);
+		break;
+	default:
+		barrier_wait_tournament(b, id);
+		break;
+	}
+}
+
+/* look up a barrier kind by name, returns -1 if there is none */
+static inline int barrier_kind(const char *name)
+{
+	for (int k = 0; k < NUM_BARRIER_KINDS; k++)
+		if (strcmp(name, barrierNames[k]) == 0)
+			return k;
+	return -1;
+}
+
+#endif
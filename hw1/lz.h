@@ -0,0 +1,182 @@
+/* a small, fast LZ77 block codec in the spirit of LZ4: greedy matching
+   through a hash table of 4 byte sequences, no entropy coding
+
+   block format, a series of sequences:
+	 token            high nibble literal count, low nibble match length - 4,
+	                  a nibble of 15 continues in bytes of 255 plus a last one
+	 literals
+	 offset           2 bytes little endian, 1..65535 back from the output
+	 match length     continuation bytes of the low nibble
+   the last sequence has literals only and ends the block
+
+   usage:
+	 uint32_t *table = malloc(LZ_TABLESIZE * sizeof(uint32_t));
+	 n = lz_compress(src, length, dst, table);     dst holds lz_bound(length)
+	 n = lz_decompress(src, n, dst, capacity);     -1 for a corrupt block
+
+*/
+#ifndef LZ_H
+#define LZ_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#define LZ_TABLEBITS 14
+#define LZ_TABLESIZE (1 << LZ_TABLEBITS)
+#define LZ_MINMATCH 4
+#define LZ_MAXOFFSET 65535
+#define LZ_LASTLITERALS 5 /* a block always ends in this many literals */
+#define LZ_MFLIMIT 12	  /* no match starts this close to the end */
+#define LZ_SKIPSHIFT 6	  /* misses in a row before the search speeds up */
+
+/* most bytes lz_compress can produce for length bytes of input */
+static inline size_t lz_bound(size_t length)
+{
+	return length + length / 255 + 16;
+}
+
+static inline uint32_t lz_read32(const unsigned char *p)
+{
+	uint32_t value;
+
+	memcpy(&value, p, sizeof(value));
+	return value;
+}
+
+static inline uint32_t lz_hash(uint32_t sequence)
+{
+	return (sequence * 2654435761u) >> (32 - LZ_TABLEBITS);
+}
+
+/* store a length past the 15 of its nibble */
+static inline unsigned char *lz_put_length(unsigned char *op, size_t length)
+{
+	for (; length >= 255; length -= 255)
+		*op++ = 255;
+	*op++ = (unsigned char)length;
+	return op;
+}
+
+static inline unsigned char *lz_put_sequence(unsigned char *op, const unsigned char *literals, size_t num_literals,
+											 size_t offset, size_t match_length)
+{
+	unsigned char *token = op++;
+
+	*token = (unsigned char)((num_literals < 15 ? num_literals : 15) << 4);
+	if (num_literals >= 15)
+		op = lz_put_length(op, num_literals - 15);
+	memcpy(op, literals, num_literals);
+	op += num_literals;
+	if (match_length == 0)
+		return op;
+
+	*op++ = (unsigned char)offset;
+	*op++ = (unsigned char)(offset >> 8);
+	match_length -= LZ_MINMATCH;
+	*token |= (unsigned char)(match_length < 15 ? match_length : 15);
+	if (match_length >= 15)
+		op = lz_put_length(op, match_length - 15);
+	return op;
+}
+
+/* compress length bytes, the table holds LZ_TABLESIZE entries and is
+   overwritten; returns the compressed length, at most lz_bound(length) */
+static inline size_t lz_compress(const void *source, size_t length, void *destination, uint32_t *table)
+{
+	const unsigned char *src = source, *anchor = src;
+	unsigned char *op = destination;
+	size_t ip = 0, misses = 0;
+
+	/* entries hold a position + 1 so that 0 means empty */
+	memset(table, 0, LZ_TABLESIZE * sizeof(uint32_t));
+	while (length >= LZ_MFLIMIT && ip < length - LZ_MFLIMIT)
+	{
+		uint32_t sequence = lz_read32(src + ip), h = lz_hash(sequence);
+		size_t ref = table[h];
+
+		table[h] = (uint32_t)(ip + 1);
+		if (ref == 0 || ip + 1 - ref > LZ_MAXOFFSET || lz_read32(src + ref - 1) != sequence)
+		{
+			/* step faster through data that keeps missing */
+			ip += 1 + (misses++ >> LZ_SKIPSHIFT);
+			continue;
+		}
+		ref--;
+
+		/* extend the match forward, and backward over pending literals */
+		size_t match_length = LZ_MINMATCH;
+		while (ip + match_length < length - LZ_LASTLITERALS && src[ref + match_length] == src[ip + match_length])
+			match_length++;
+		while (src + ip > anchor && ref > 0 && src[ip - 1] == src[ref - 1])
+		{
+			ip--;
+			ref--;
+			match_length++;
+		}
+
+		op = lz_put_sequence(op, anchor, src + ip - anchor, ip - ref, match_length);
+		ip += match_length;
+		anchor = src + ip;
+		misses = 0;
+	}
+
+	op = lz_put_sequence(op, anchor, src + length - anchor, 0, 0);
+	return (size_t)(op - (unsigned char *)destination);
+}
+
+/* read a length past the 15 of its nibble, false when the input ends */
+static inline int lz_get_length(const unsigned char **ip, const unsigned char *end, size_t *length)
+{
+	unsigned char byte;
+
+	do
+	{
+		if (*ip == end)
+			return 0;
+		byte = *(*ip)++;
+		*length += byte;
+	} while (byte == 255);
+	return 1;
+}
+
+/* decompress a block into at most capacity bytes; returns the
+   decompressed length, or -1 if the block is corrupt or does not fit */
+static inline long lz_decompress(const void *source, size_t length, void *destination, size_t capacity)
+{
+	const unsigned char *ip = source, *end = ip + length;
+	unsigned char *out = destination, *op = out;
+
+	while (ip < end)
+	{
+		unsigned token = *ip++;
+		size_t num_literals = token >> 4, match_length = token & 15, offset;
+
+		if (num_literals == 15 && !lz_get_length(&ip, end, &num_literals))
+			return -1;
+		if (num_literals > (size_t)(end - ip) || num_literals > capacity - (size_t)(op - out))
+			return -1;
+		memcpy(op, ip, num_literals);
+		ip += num_literals;
+		op += num_literals;
+		if (ip == end)
+			break;
+
+		if (end - ip < 2)
+			return -1;
+		offset = ip[0] | (size_t)ip[1] << 8;
+		ip += 2;
+		if (match_length == 15 && !lz_get_length(&ip, end, &match_length))
+			return -1;
+		match_length += LZ_MINMATCH;
+		if (offset == 0 || offset > (size_t)(op - out) || match_length > capacity - (size_t)(op - out))
+			return -1;
+
+		/* byte by byte, since a match may overlap the bytes it produces */
+		for (const unsigned char *ref = op - offset; match_length > 0; match_length--)
+			*op++ = *ref++;
+	}
+	return (long)(op - out);
+}
+
+#endif
@@ -1,238 +1,2349 @@
-/* matrix summation using pthreads
-
-   features: uses a barrier; the Worker[0] computes
-			 the total sum from partial sums computed by Workers
-			 and prints the total sum to the standard output
-
-   usage under Linux:
-	 gcc matrixSum.c -lpthread
-	 a.out size numWorkers
-
-*/
-#ifndef _REENTRANT
-#define _REENTRANT
-#endif
-#include <pthread.h>
-#include <stdlib.h>
-#include <stdio.h>
-#include <stdbool.h>
-#include <time.h>
-#include <sys/time.h>
-#include <limits.h>
-#include <unistd.h>
-
-#define MAXSIZE 10000 /* maximum matrix size */
-#define MAXWORKERS 10 /* maximum number of workers */
-// #define DEBUG
-
-pthread_mutex_t barrier; /* mutex lock for the barrier */
-pthread_cond_t go;		 /* condition variable for leaving */
-int numWorkers;			 /* number of workers */
-int numArrived = 0;		 /* number who have arrived */
-
-int next_row_counter = 0;
-pthread_mutex_t next_row_counter_mutex;
-
-int get_next_row()
-{
-	pthread_mutex_lock(&next_row_counter_mutex);
-	int row = next_row_counter++;
-	pthread_mutex_unlock(&next_row_counter_mutex);
-	return row;
-}
-
-/* a reusable counter barrier */
-void Barrier()
-{
-	pthread_mutex_lock(&barrier);
-	numArrived++;
-	if (numArrived == numWorkers)
-	{
-		numArrived = 0;
-		pthread_cond_broadcast(&go);
-	}
-	else
-		pthread_cond_wait(&go, &barrier);
-	pthread_mutex_unlock(&barrier);
-}
-
-/* timer */
-double read_timer()
-{
-	static bool initialized = false;
-	static struct timeval start;
-	struct timeval end;
-	if (!initialized)
-	{
-		gettimeofday(&start, NULL);
-		initialized = true;
-	}
-	gettimeofday(&end, NULL);
-	return (end.tv_sec - start.tv_sec) + 1.0e-6 * (end.tv_usec - start.tv_usec);
-}
-
-double start_time, end_time;  /* start and end times */
-int size, stripSize;		  /* assume size is multiple of numWorkers */
-int matrix[MAXSIZE][MAXSIZE]; /* matrix */
-
-void *Worker(void *);
-
-typedef struct
-{
-	int sum;
-	int max;
-	int min;
-	int max_pos;
-	int min_pos;
-} WorkerResult;
-
-/* read command line, initialize, and create threads */
-int main(int argc, char *argv[])
-{
-	int i, j;
-	long l; /* use long in case of a 64-bit system */
-	pthread_attr_t attr;
-	pthread_t workerid[MAXWORKERS];
-
-	/* set global thread attributes */
-	pthread_attr_init(&attr);
-	pthread_attr_setscope(&attr, PTHREAD_SCOPE_SYSTEM);
-
-	/* initialize mutex and condition variable */
-	pthread_mutex_init(&barrier, NULL);
-	pthread_mutex_init(&next_row_counter_mutex, NULL);
-	pthread_cond_init(&go, NULL);
-
-	/* read command line args if any */
-	size = (argc > 1) ? atoi(argv[1]) : MAXSIZE;
-	numWorkers = (argc > 2) ? atoi(argv[2]) : MAXWORKERS;
-	if (size > MAXSIZE)
-		size = MAXSIZE;
-	if (numWorkers > MAXWORKERS)
-		numWorkers = MAXWORKERS;
-	else if (numWorkers > size)
-		numWorkers = size;
-	stripSize = size / numWorkers;
-
-	/* initialize the matrix */
-	srand(time(NULL));
-
-	for (i = 0; i < size; i++)
-	{
-		for (j = 0; j < size; j++)
-		{
-			matrix[i][j] = rand() % 99;
-		}
-	}
-
-	/* print the matrix */
-#ifdef DEBUG
-	for (i = 0; i < size; i++)
-	{
-		printf("%d: [ ", i);
-		for (j = 0; j < size; j++)
-		{
-			printf(" %d", matrix[i][j]);
-		}
-		printf(" ]\n");
-	}
-#endif
-
-	/* do the parallel work: create the workers */
-	start_time = read_timer();
-	for (l = 0; l < numWorkers; l++)
-		pthread_create(&workerid[l], &attr, Worker, (void *)l);
-
-	/* Create variables for storing data. */
-	int total = 0;
-	int min = INT_MAX;
-	int max = INT_MIN;
-	int min_pos, max_pos;
-
-	/* Join the results from all workers */
-	for (l = 0; l < numWorkers; l++)
-	{
-		WorkerResult *cur_result;
-		pthread_join(workerid[l], (void **)&cur_result);
-
-		total += cur_result->sum;
-		if (cur_result->max > max)
-		{
-			max = cur_result->max;
-			max_pos = cur_result->max_pos;
-		}
-		if (cur_result->min < min)
-		{
-			min = cur_result->min;
-			min_pos = cur_result->min_pos;
-		}
-
-#ifdef DEBUG
-		printf("\nmax->%ld: %d\n", l, cur_result->max);
-		printf("max_pos->%ld: %d\n", l, cur_result->max_pos);
-		printf("min->%ld: %d\n", l, cur_result->min);
-		printf("min_pos->%ld: %d\n\n", l, cur_result->min_pos);
-#endif
-
-		free(cur_result);
-	}
-
-	/* get end time */
-	end_time = read_timer();
-
-	printf("Global max: %d (%d,%d)\n", max, (int)(max_pos / size), max_pos % size);
-	printf("Global min: %d (%d,%d)\n", min, (int)(min_pos / size), min_pos % size);
-	printf("The total is %d\n", total);
-	printf("The execution time is %g sec\n", end_time - start_time);
-}
-
-/* Each worker sums the values in one strip of the matrix.
-   After a barrier, worker(0) computes and prints the total */
-void *Worker(void *arg)
-{
-	long myid = (long)arg;
-	int total, min, max;
-	int min_pos, max_pos;
-
-#ifdef DEBUG
-	printf("INIT: worker %ld (pthread id %lu) has started\n", myid, (unsigned long)pthread_self());
-#endif
-
-	/* sum values in my strip */
-	total = 0;
-	min = INT_MAX;
-	max = INT_MIN;
-
-	int cur_row;
-	int i;
-
-	while ((cur_row = get_next_row()) < size)
-	{
-#ifdef DEBUG
-		printf("TASK: worker %ld started working on row #%d\n", myid, cur_row);
-#endif
-		for (i = 0; i < size; i++)
-		{
-			total += matrix[cur_row][i];
-			if (matrix[cur_row][i] > max)
-			{
-				max = matrix[cur_row][i];
-				max_pos = cur_row * size + i;
-			}
-			if (matrix[cur_row][i] < min)
-			{
-				min = matrix[cur_row][i];
-				min_pos = cur_row * size + i;
-			}
-		}
-	}
-
-	WorkerResult *result = malloc(sizeof(WorkerResult));
-	result->sum = total;
-	result->max = max;
-	result->min = min;
-	result->max_pos = max_pos;
-	result->min_pos = min_pos;
-
-	pthread_exit((void *)result);
-}
+/* matrix summation using pthreads
+
+   features: uses a barrier (see barrier.h) between the rounds in which
+			 the Workers combine their partial results, Worker[0] ends
+			 up with the totals which main prints to the standard output
+
+   usage under Linux:
+	 gcc matrixSum.c -lpthread
+	 a.out size numWorkers [options]
+	 a.out columns numWorkers -f matrix.bin [options]
+
+   options:
+	 -m, --dispatch static|mutex|chunk|guided
+	                                    how rows are handed out (default chunk, static with -p)
+	 -c, --chunk n                      rows per chunk, smallest chunk when guided (default 16)
+	 -k, --kernel auto|scalar|sse2|avx2|avx512
+	                                    int32 row reduction kernel (default auto, picked by CPUID)
+	 -p, --pin                          pin worker i to the i-th allowed CPU for both
+	                                    initialization and reduction
+	 -s, --seed n                       seed for the matrix values (default: current time),
+	                                    the same seed always gives the same matrix
+	 -f, --file path                    reduce a raw row-major file of --type with the given
+	                                    number of columns instead of generating a matrix;
+	                                    the file is memory-mapped and streamed, so it may
+	                                    be larger than memory
+	 -w, --write path                   write the generated matrix to path in that format
+	 -t, --type int8|int16|int32|int64|float|double
+	                                    element type of the matrix (default int32); sums are
+	                                    64-bit for integers and compensated for floating point
+	 -r, --reduce op[,op...]            statistics computed in one pass (default minmax):
+	                                    minmax, sum, sumsq, hist[:lo:hi[:bins]] (default
+	                                    0:100:10), topk[:k] (default 10), rowsums, colsums,
+	                                    tiled (global, row and column sum/min/max in one
+	                                    cache blocked pass)
+	 -o, --results path                 write the tiled aggregates to path as binary
+	 -B, --barrier mutex|sense|dissemination|tournament
+	                                    barrier between the combine rounds (default sense)
+	 -L, --bench-barriers               time every barrier kind for 1..numWorkers threads
+	 -b, --bench                        time every dispatch mode for 1..numWorkers threads
+	 -P, --procs n                      split the rows into n bands reduced by n forked shard
+	                                    processes of numWorkers threads each, which send their
+	                                    results back to this process over a socket
+	 -S, --socket unix:path|tcp:[host:]port
+	                                    where the shards reach the coordinator (default
+	                                    unix:/tmp/matrixSum.<pid>.sock, tcp port 0 picks a port)
+
+*/
+#ifndef _REENTRANT
+#define _REENTRANT
+#endif
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <getopt.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/time.h>
+#include <limits.h>
+#include <math.h>
+#include <unistd.h>
+#include <immintrin.h>
+#include "barrier.h"
+
+#define DEFAULTSIZE 10000 /* matrix size when none is given */
+#define HUGEPAGESIZE (2UL << 20) /* matrix allocations are rounded up to this */
+#define STREAMWINDOW (4UL << 20) /* bytes of a streamed file a worker reduces before dropping them */
+#define BENCHRUNS 3 /* repetitions per benchmark point, best time is kept */
+#define BARRIERROUNDS 10000 /* barrier episodes timed per barrier benchmark point */
+// #define DEBUG
+
+int numWorkers; /* number of workers */
+
+/* element types the matrix can hold */
+typedef enum
+{
+	ELEM_INT8,
+	ELEM_INT16,
+	ELEM_INT32,
+	ELEM_INT64,
+	ELEM_FLOAT,
+	ELEM_DOUBLE,
+	NUM_ELEM_TYPES
+} ElemType;
+
+const char *elemNames[NUM_ELEM_TYPES] = {"int8", "int16", "int32", "int64", "float", "double"};
+const size_t elemSizes[NUM_ELEM_TYPES] = {1, 2, 4, 8, 4, 8};
+ElemType elemType = ELEM_INT32;
+#define IS_FLOAT_TYPE(t) ((t) >= ELEM_FLOAT)
+
+double start_time, end_time; /* start and end times */
+int size;					 /* number of columns */
+int rows;					 /* number of rows held by this process, size unless read from a file or sharded */
+int firstRow = 0;			 /* global index of the first row held, rows are [firstRow, firstRow + rows) */
+void *matrix;				 /* row-major elements of elemType, starting with row firstRow */
+void *matrixBase;			 /* start of the mapping holding matrix */
+size_t matrixBytes;			 /* mapped length of matrixBase */
+const char *inputPath;		 /* matrix file to stream from, NULL to generate */
+
+/* address of row i of the matrix */
+static inline void *matrix_row(int i)
+{
+	return (char *)matrix + (size_t)(i - firstRow) * size * elemSizes[elemType];
+}
+
+/* one past the last row held by this process */
+static inline int end_row()
+{
+	return firstRow + rows;
+}
+
+/* first row of worker id's strip, strip id is [strip_begin(id), strip_begin(id + 1)) */
+static inline int strip_begin(long id)
+{
+	return firstRow + (int)(id * rows / numWorkers);
+}
+
+/* map the matrix untouched so every page is placed by the worker that first
+   writes it; explicit huge pages are used when the system has them reserved,
+   otherwise transparent huge pages are requested */
+void *alloc_matrix(size_t bytes)
+{
+	void *p;
+
+	matrixBytes = (bytes + HUGEPAGESIZE - 1) & ~(HUGEPAGESIZE - 1);
+	p = mmap(NULL, matrixBytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+	if (p == MAP_FAILED)
+	{
+		p = mmap(NULL, matrixBytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+		if (p == MAP_FAILED)
+			return NULL;
+		madvise(p, matrixBytes, MADV_HUGEPAGE);
+	}
+	matrixBase = p;
+	return p;
+}
+
+/* number of whole rows of size columns in a raw matrix file, 0 if it cannot be read */
+int matrix_file_rows(const char *path)
+{
+	struct stat st;
+
+	if (stat(path, &st) != 0)
+		return 0;
+	return (int)(st.st_size / ((off_t)size * elemSizes[elemType]));
+}
+
+/* map rows [firstRow, firstRow + rows) of a raw row-major file of elemType
+   elements with size columns read-only, the rows are paged in as workers
+   reach them and dropped again once reduced */
+void *map_matrix_file(const char *path)
+{
+	off_t page = sysconf(_SC_PAGESIZE);
+	off_t offset = (off_t)firstRow * size * elemSizes[elemType];
+	int fd = open(path, O_RDONLY);
+
+	if (fd < 0)
+		return NULL;
+	matrixBytes = (offset & (page - 1)) + (size_t)rows * size * elemSizes[elemType];
+	matrixBase = mmap(NULL, matrixBytes, PROT_READ, MAP_SHARED, fd, offset & ~(page - 1));
+	close(fd);
+	if (matrixBase == MAP_FAILED)
+		return NULL;
+	madvise(matrixBase, matrixBytes, MADV_SEQUENTIAL);
+	return (char *)matrixBase + (offset & (page - 1));
+}
+
+/* apply a madvise to the pages holding rows [first, last) of a mapped file;
+   WILLNEED rounds outwards, anything else only covers whole pages inside */
+void advise_rows(int first, int last, int advice)
+{
+	uintptr_t page = (uintptr_t)sysconf(_SC_PAGESIZE);
+	uintptr_t begin, end;
+
+	if (first >= end_row())
+		return;
+	if (last > end_row())
+		last = end_row();
+	begin = (uintptr_t)matrix_row(first);
+	end = (uintptr_t)matrix_row(last);
+	if (advice == MADV_WILLNEED)
+	{
+		begin &= ~(page - 1);
+		end = (end + page - 1) & ~(page - 1);
+	}
+	else
+	{
+		begin = (begin + page - 1) & ~(page - 1);
+		end &= ~(page - 1);
+	}
+	if (begin < end)
+		madvise((void *)begin, end - begin, advice);
+}
+
+/* write the matrix to path as raw rows of elemType */
+bool write_matrix_file(const char *path)
+{
+	FILE *out = fopen(path, "wb");
+	bool ok;
+
+	if (out == NULL)
+		return false;
+	ok = fwrite(matrix, elemSizes[elemType], (size_t)rows * size, out) == (size_t)rows * size;
+	return fclose(out) == 0 && ok;
+}
+
+bool pinWorkers = false; /* pin worker i to cpuList[(firstCpu + i) % numCpus] */
+int *cpuList;			 /* CPUs this process may run on */
+int numCpus;
+int firstCpu = 0; /* shard processes start at different CPUs so their workers do not share one */
+
+/* collect the CPUs in the affinity mask of the process */
+void read_cpu_list()
+{
+	cpu_set_t set;
+
+	cpuList = malloc(CPU_SETSIZE * sizeof(int));
+	numCpus = 0;
+	if (sched_getaffinity(0, sizeof(set), &set) == 0)
+	{
+		for (int c = 0; c < CPU_SETSIZE; c++)
+			if (CPU_ISSET(c, &set))
+				cpuList[numCpus++] = c;
+	}
+	if (numCpus == 0)
+		cpuList[numCpus++] = 0;
+}
+
+/* with pinning on, bind the calling worker to its CPU so the same strip is
+   touched from the same socket during initialization and reduction */
+void pin_worker(long myid)
+{
+	cpu_set_t set;
+
+	if (!pinWorkers)
+		return;
+	CPU_ZERO(&set);
+	CPU_SET(cpuList[(firstCpu + myid) % numCpus], &set);
+	pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+/* how workers claim rows of the matrix */
+typedef enum
+{
+	DISPATCH_STATIC, /* one contiguous strip per worker, matches the initialization */
+	DISPATCH_MUTEX,	 /* one row per lock of next_row_counter_mutex */
+	DISPATCH_CHUNK,	 /* fixed chunks claimed with one atomic fetch-add */
+	DISPATCH_GUIDED, /* chunks shrink with the remaining work, claimed with a CAS */
+	NUM_DISPATCH_MODES
+} DispatchMode;
+
+const char *dispatchNames[NUM_DISPATCH_MODES] = {"static", "mutex", "chunk", "guided"};
+DispatchMode dispatchMode = DISPATCH_CHUNK;
+int chunkSize = 16; /* rows per chunk, lower bound for guided chunks */
+
+atomic_int next_row_counter;
+pthread_mutex_t next_row_counter_mutex;
+
+/* claim the rows [*first, *last) for worker myid, returns false once every
+   row has been handed out; *first must be -1 on the worker's first call */
+bool get_next_rows(long myid, int *first, int *last)
+{
+	int row, n;
+
+	switch (dispatchMode)
+	{
+	case DISPATCH_STATIC:
+		if (*first != -1)
+			return false;
+		*first = strip_begin(myid);
+		*last = strip_begin(myid + 1);
+		return *first < *last;
+	case DISPATCH_MUTEX:
+		pthread_mutex_lock(&next_row_counter_mutex);
+		row = atomic_load_explicit(&next_row_counter, memory_order_relaxed);
+		atomic_store_explicit(&next_row_counter, row + 1, memory_order_relaxed);
+		pthread_mutex_unlock(&next_row_counter_mutex);
+		n = 1;
+		break;
+	case DISPATCH_GUIDED:
+		row = atomic_load_explicit(&next_row_counter, memory_order_relaxed);
+		do
+		{
+			if (row >= end_row())
+				return false;
+			n = (end_row() - row) / (2 * numWorkers);
+			if (n < chunkSize)
+				n = chunkSize;
+		} while (!atomic_compare_exchange_weak_explicit(&next_row_counter, &row, row + n,
+														memory_order_relaxed, memory_order_relaxed));
+		break;
+	default:
+		n = chunkSize;
+		row = atomic_fetch_add_explicit(&next_row_counter, n, memory_order_relaxed);
+		break;
+	}
+
+	if (row >= end_row())
+		return false;
+	*first = row;
+	*last = (row + n < end_row()) ? row + n : end_row();
+	return true;
+}
+
+/* timer */
+double read_timer()
+{
+	static bool initialized = false;
+	static struct timeval start;
+	struct timeval end;
+	if (!initialized)
+	{
+		gettimeofday(&start, NULL);
+		initialized = true;
+	}
+	gettimeofday(&end, NULL);
+	return (end.tv_sec - start.tv_sec) + 1.0e-6 * (end.tv_usec - start.tv_usec);
+}
+
+void *Worker(void *);
+
+/* an element or a sum, integer types use i and floating point types use f */
+typedef union
+{
+	int64_t i;
+	double f;
+} Value;
+
+typedef struct
+{
+	Value sum;	 /* integers are summed in 64 bits */
+	double comp; /* Kahan compensation of a floating point sum, the sum is sum.f - comp */
+	Value max;
+	Value min;
+	long max_pos; /* row * size + column, -1 while nothing has been reduced */
+	long min_pos;
+} WorkerResult;
+
+static inline bool value_less(Value a, Value b)
+{
+	return IS_FLOAT_TYPE(elemType) ? a.f < b.f : a.i < b.i;
+}
+
+static inline bool value_equal(Value a, Value b)
+{
+	return IS_FLOAT_TYPE(elemType) ? a.f == b.f : a.i == b.i;
+}
+
+/* print a value of the current element type */
+void print_value(FILE *out, Value v)
+{
+	if (IS_FLOAT_TYPE(elemType))
+		fprintf(out, "%.17g", v.f);
+	else
+		fprintf(out, "%lld", (long long)v.i);
+}
+
+/* the element at column j of a row */
+Value element_value(const void *row, int j)
+{
+	switch (elemType)
+	{
+	case ELEM_INT8:
+		return (Value){.i = ((const int8_t *)row)[j]};
+	case ELEM_INT16:
+		return (Value){.i = ((const int16_t *)row)[j]};
+	case ELEM_INT32:
+		return (Value){.i = ((const int32_t *)row)[j]};
+	case ELEM_INT64:
+		return (Value){.i = ((const int64_t *)row)[j]};
+	case ELEM_FLOAT:
+		return (Value){.f = ((const float *)row)[j]};
+	default:
+		return (Value){.f = ((const double *)row)[j]};
+	}
+}
+
+void init_result(WorkerResult *r)
+{
+	memset(r, 0, sizeof(*r));
+	r->max_pos = r->min_pos = -1;
+}
+
+/* Kahan add v to *sum, whose compensation is *comp */
+static inline void kahan_add(double *sum, double *comp, double v)
+{
+	double y = v - *comp;
+	double t = *sum + y;
+	*comp = (t - *sum) - y;
+	*sum = t;
+}
+
+/* add v to the sum of r, wrapping for integers and Kahan compensated for floating point */
+static inline void add_sum(WorkerResult *r, Value v)
+{
+	if (IS_FLOAT_TYPE(elemType))
+		kahan_add(&r->sum.f, &r->comp, v.f);
+	else
+		r->sum.i = (int64_t)((uint64_t)r->sum.i + (uint64_t)v.i);
+}
+
+/* fold r into acc with the positions of r shifted by offset; ties keep the
+   smaller position, so the result does not depend on the merge order */
+void merge_result(WorkerResult *acc, const WorkerResult *r, long offset)
+{
+	if (r->max_pos < 0)
+		return;
+	add_sum(acc, r->sum);
+	if (IS_FLOAT_TYPE(elemType))
+		add_sum(acc, (Value){.f = -r->comp});
+	if (acc->max_pos < 0 || value_less(acc->max, r->max) ||
+		(value_equal(acc->max, r->max) && r->max_pos + offset < acc->max_pos))
+	{
+		acc->max = r->max;
+		acc->max_pos = r->max_pos + offset;
+	}
+	if (acc->min_pos < 0 || value_less(r->min, acc->min) ||
+		(value_equal(acc->min, r->min) && r->min_pos + offset < acc->min_pos))
+	{
+		acc->min = r->min;
+		acc->min_pos = r->min_pos + offset;
+	}
+}
+
+/* row reduction kernels: each one computes the sum, min and max of a row of
+   n >= 1 elements and the column of the first occurrence of min and max, so
+   the vector kernels produce exactly what the scalar loop would */
+typedef void (*RowKernel)(const void *row, int n, WorkerResult *r);
+
+/* kernel for an integer element type, summed in 64 bits; the first pass has
+   no position tracking so the compiler can vectorize it at the element width,
+   the second pass finds the first min and max in the row, which is still in
+   cache */
+#define INT_ROW_KERNEL(name, T)                                       \
+	__attribute__((optimize("tree-vectorize"))) void                  \
+	name(const void *vrow, int n, WorkerResult *r)                    \
+	{                                                                 \
+		const T *row = vrow;                                          \
+		uint64_t sum = 0;                                             \
+		T min = row[0], max = row[0];                                 \
+		int i;                                                        \
+		for (i = 0; i < n; i++)                                       \
+		{                                                             \
+			sum += (uint64_t)(int64_t)row[i];                         \
+			max = (row[i] > max) ? row[i] : max;                      \
+			min = (row[i] < min) ? row[i] : min;                      \
+		}                                                             \
+		r->sum.i = (int64_t)sum;                                      \
+		r->comp = 0;                                                  \
+		r->max.i = max;                                               \
+		r->min.i = min;                                               \
+		r->max_pos = r->min_pos = -1;                                 \
+		for (i = 0; i < n && (r->max_pos < 0 || r->min_pos < 0); i++) \
+		{                                                             \
+			if (r->max_pos < 0 && row[i] == max)                      \
+				r->max_pos = i;                                       \
+			if (r->min_pos < 0 && row[i] == min)                      \
+				r->min_pos = i;                                       \
+		}                                                             \
+	}
+
+#define PAIRWISEBLOCK 128 /* elements summed sequentially before pairwise combining */
+
+/* kernel for a floating point element type; the row is summed in blocks
+   whose partial sums are combined pairwise like a binary counter, so the
+   rounding error grows with log n instead of n, and the positions are found
+   in a second pass as in INT_ROW_KERNEL */
+#define FLOAT_ROW_KERNEL(name, T)                                      \
+	__attribute__((optimize("tree-vectorize"))) void                   \
+	name(const void *vrow, int n, WorkerResult *r)                     \
+	{                                                                  \
+		const T *row = vrow;                                           \
+		double partial[40];                                            \
+		int depth = 0, i;                                              \
+		long blocks = 0;                                               \
+		T min = row[0], max = row[0];                                  \
+		for (int b = 0; b < n; b += PAIRWISEBLOCK)                     \
+		{                                                              \
+			int end = (b + PAIRWISEBLOCK < n) ? b + PAIRWISEBLOCK : n; \
+			double s[4] = {0, 0, 0, 0};                                \
+			for (i = b; i < end; i++)                                  \
+			{                                                          \
+				s[i & 3] += row[i];                                    \
+				max = (row[i] > max) ? row[i] : max;                   \
+				min = (row[i] < min) ? row[i] : min;                   \
+			}                                                          \
+			s[0] = (s[0] + s[1]) + (s[2] + s[3]);                      \
+			for (long k = ++blocks; !(k & 1); k >>= 1)                 \
+				s[0] += partial[--depth];                              \
+			partial[depth++] = s[0];                                   \
+		}                                                              \
+		r->sum.f = 0;                                                  \
+		while (depth > 0)                                              \
+			r->sum.f += partial[--depth];                              \
+		r->comp = 0;                                                   \
+		r->max.f = max;                                                \
+		r->min.f = min;                                                \
+		r->max_pos = r->min_pos = -1;                                  \
+		for (i = 0; i < n && (r->max_pos < 0 || r->min_pos < 0); i++)  \
+		{                                                              \
+			if (r->max_pos < 0 && row[i] == max)                       \
+				r->max_pos = i;                                        \
+			if (r->min_pos < 0 && row[i] == min)                       \
+				r->min_pos = i;                                        \
+		}                                                              \
+		if (r->max_pos < 0) /* NaN in the first column */              \
+			r->max_pos = 0;                                            \
+		if (r->min_pos < 0)                                            \
+			r->min_pos = 0;                                            \
+	}
+
+INT_ROW_KERNEL(reduce_row_int8, int8_t)
+INT_ROW_KERNEL(reduce_row_int16, int16_t)
+INT_ROW_KERNEL(reduce_row_scalar, int32_t)
+INT_ROW_KERNEL(reduce_row_int64, int64_t)
+FLOAT_ROW_KERNEL(reduce_row_float, float)
+FLOAT_ROW_KERNEL(reduce_row_double, double)
+
+/* int32 vector kernels */
+
+/* reduce row[from..n) into *r after the vector part has been folded in */
+void reduce_row_tail(const int *row, int from, int n, WorkerResult *r)
+{
+	for (int i = from; i < n; i++)
+	{
+		r->sum.i += row[i];
+		if (row[i] > r->max.i)
+		{
+			r->max.i = row[i];
+			r->max_pos = i;
+		}
+		if (row[i] < r->min.i)
+		{
+			r->min.i = row[i];
+			r->min_pos = i;
+		}
+	}
+}
+
+/* fold the per-lane partials of a vector kernel into *r; every lane only
+   moves its position on a strict improvement, so among lanes holding the
+   extreme value the smallest position is the first occurrence in the row */
+void reduce_row_lanes(const int64_t *sum, int sumLanes, const int *min, const int *min_pos,
+					  const int *max, const int *max_pos, int lanes, WorkerResult *r)
+{
+	uint64_t total = 0;
+
+	r->min.i = INT_MAX;
+	r->max.i = INT_MIN;
+	r->min_pos = r->max_pos = 0;
+	r->comp = 0;
+	for (int l = 0; l < sumLanes; l++)
+		total += (uint64_t)sum[l];
+	for (int l = 0; l < lanes; l++)
+	{
+		if (min[l] < r->min.i || (min[l] == r->min.i && min_pos[l] < r->min_pos))
+		{
+			r->min.i = min[l];
+			r->min_pos = min_pos[l];
+		}
+		if (max[l] > r->max.i || (max[l] == r->max.i && max_pos[l] < r->max_pos))
+		{
+			r->max.i = max[l];
+			r->max_pos = max_pos[l];
+		}
+	}
+	r->sum.i = (int64_t)total;
+}
+
+__attribute__((target("sse2"))) void reduce_row_sse2(const void *vrow, int n, WorkerResult *r)
+{
+	const int *row = vrow;
+	__m128i sum = _mm_setzero_si128();
+	__m128i min = _mm_set1_epi32(INT_MAX), min_pos = _mm_setzero_si128();
+	__m128i max = _mm_set1_epi32(INT_MIN), max_pos = _mm_setzero_si128();
+	__m128i pos = _mm_setr_epi32(0, 1, 2, 3), step = _mm_set1_epi32(4);
+	int i;
+
+	for (i = 0; i + 4 <= n; i += 4)
+	{
+		__m128i v = _mm_loadu_si128((const __m128i *)(row + i));
+
+		/* SSE2 cannot sign extend to 64 bits directly, interleave with the sign */
+		__m128i sign = _mm_srai_epi32(v, 31);
+		sum = _mm_add_epi64(sum, _mm_unpacklo_epi32(v, sign));
+		sum = _mm_add_epi64(sum, _mm_unpackhi_epi32(v, sign));
+
+		/* SSE2 has no blend or 32-bit min/max, select with and/andnot/or */
+		__m128i lt = _mm_cmplt_epi32(v, min);
+		min = _mm_or_si128(_mm_and_si128(lt, v), _mm_andnot_si128(lt, min));
+		min_pos = _mm_or_si128(_mm_and_si128(lt, pos), _mm_andnot_si128(lt, min_pos));
+		__m128i gt = _mm_cmpgt_epi32(v, max);
+		max = _mm_or_si128(_mm_and_si128(gt, v), _mm_andnot_si128(gt, max));
+		max_pos = _mm_or_si128(_mm_and_si128(gt, pos), _mm_andnot_si128(gt, max_pos));
+
+		pos = _mm_add_epi32(pos, step);
+	}
+
+	int64_t sums[2];
+	int lanes[4][4];
+	_mm_storeu_si128((__m128i *)sums, sum);
+	_mm_storeu_si128((__m128i *)lanes[0], min);
+	_mm_storeu_si128((__m128i *)lanes[1], min_pos);
+	_mm_storeu_si128((__m128i *)lanes[2], max);
+	_mm_storeu_si128((__m128i *)lanes[3], max_pos);
+	reduce_row_lanes(sums, 2, lanes[0], lanes[1], lanes[2], lanes[3], 4, r);
+	reduce_row_tail(row, i, n, r);
+}
+
+__attribute__((target("avx2"))) void reduce_row_avx2(const void *vrow, int n, WorkerResult *r)
+{
+	const int *row = vrow;
+	__m256i sum = _mm256_setzero_si256();
+	__m256i min = _mm256_set1_epi32(INT_MAX), min_pos = _mm256_setzero_si256();
+	__m256i max = _mm256_set1_epi32(INT_MIN), max_pos = _mm256_setzero_si256();
+	__m256i pos = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7), step = _mm256_set1_epi32(8);
+	int i;
+
+	for (i = 0; i + 8 <= n; i += 8)
+	{
+		__m256i v = _mm256_loadu_si256((const __m256i *)(row + i));
+		sum = _mm256_add_epi64(sum, _mm256_cvtepi32_epi64(_mm256_castsi256_si128(v)));
+		sum = _mm256_add_epi64(sum, _mm256_cvtepi32_epi64(_mm256_extracti128_si256(v, 1)));
+
+		__m256i lt = _mm256_cmpgt_epi32(min, v);
+		min = _mm256_min_epi32(min, v);
+		min_pos = _mm256_blendv_epi8(min_pos, pos, lt);
+		__m256i gt = _mm256_cmpgt_epi32(v, max);
+		max = _mm256_max_epi32(max, v);
+		max_pos = _mm256_blendv_epi8(max_pos, pos, gt);
+
+		pos = _mm256_add_epi32(pos, step);
+	}
+
+	int64_t sums[4];
+	int lanes[4][8];
+	_mm256_storeu_si256((__m256i *)sums, sum);
+	_mm256_storeu_si256((__m256i *)lanes[0], min);
+	_mm256_storeu_si256((__m256i *)lanes[1], min_pos);
+	_mm256_storeu_si256((__m256i *)lanes[2], max);
+	_mm256_storeu_si256((__m256i *)lanes[3], max_pos);
+	reduce_row_lanes(sums, 4, lanes[0], lanes[1], lanes[2], lanes[3], 8, r);
+	reduce_row_tail(row, i, n, r);
+}
+
+__attribute__((target("avx512f"))) void reduce_row_avx512(const void *vrow, int n, WorkerResult *r)
+{
+	const int *row = vrow;
+	__m512i sum = _mm512_setzero_si512();
+	__m512i min = _mm512_set1_epi32(INT_MAX), min_pos = _mm512_setzero_si512();
+	__m512i max = _mm512_set1_epi32(INT_MIN), max_pos = _mm512_setzero_si512();
+	__m512i pos = _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+	__m512i step = _mm512_set1_epi32(16);
+	int i;
+
+	for (i = 0; i + 16 <= n; i += 16)
+	{
+		__m512i v = _mm512_loadu_si512((const void *)(row + i));
+		sum = _mm512_add_epi64(sum, _mm512_cvtepi32_epi64(_mm512_castsi512_si256(v)));
+		sum = _mm512_add_epi64(sum, _mm512_cvtepi32_epi64(_mm512_extracti64x4_epi64(v, 1)));
+
+		__mmask16 lt = _mm512_cmplt_epi32_mask(v, min);
+		min = _mm512_min_epi32(min, v);
+		min_pos = _mm512_mask_mov_epi32(min_pos, lt, pos);
+		__mmask16 gt = _mm512_cmpgt_epi32_mask(v, max);
+		max = _mm512_max_epi32(max, v);
+		max_pos = _mm512_mask_mov_epi32(max_pos, gt, pos);
+
+		pos = _mm512_add_epi32(pos, step);
+	}
+
+	int64_t sums[8];
+	int lanes[4][16];
+	_mm512_storeu_si512((void *)sums, sum);
+	_mm512_storeu_si512((void *)lanes[0], min);
+	_mm512_storeu_si512((void *)lanes[1], min_pos);
+	_mm512_storeu_si512((void *)lanes[2], max);
+	_mm512_storeu_si512((void *)lanes[3], max_pos);
+	reduce_row_lanes(sums, 8, lanes[0], lanes[1], lanes[2], lanes[3], 16, r);
+	reduce_row_tail(row, i, n, r);
+}
+
+/* int32 kernels selectable with --kernel */
+const char *kernelNames[] = {"scalar", "sse2", "avx2", "avx512"};
+RowKernel kernels[] = {reduce_row_scalar, reduce_row_sse2, reduce_row_avx2, reduce_row_avx512};
+#define NUM_KERNELS (int)(sizeof(kernels) / sizeof(kernels[0]))
+int kernelIndex = -1; /* -1 picks the widest kernel the CPU supports */
+
+/* kernels of the other element types, the int32 entry is taken from kernels[] */
+RowKernel typeKernels[NUM_ELEM_TYPES] = {reduce_row_int8, reduce_row_int16, NULL,
+										 reduce_row_int64, reduce_row_float, reduce_row_double};
+RowKernel row_kernel = reduce_row_scalar;
+
+/* check a kernel's instruction set against CPUID */
+bool kernel_supported(int k)
+{
+	__builtin_cpu_init();
+	switch (k)
+	{
+	case 1:
+		return __builtin_cpu_supports("sse2");
+	case 2:
+		return __builtin_cpu_supports("avx2");
+	case 3:
+		return __builtin_cpu_supports("avx512f");
+	default:
+		return true;
+	}
+}
+
+pthread_attr_t attr;
+uint64_t seed; /* seed for the matrix values */
+
+/* counter based generator: splitmix64 applied to the (row, col) counter, so
+   the value of an element only depends on the seed and its position and any
+   worker can fill any block of the matrix without shared state */
+static inline uint64_t matrix_bits(int row, int col)
+{
+	uint64_t z = seed + ((((uint64_t)row << 32) | (uint32_t)col) + 1) * 0x9E3779B97F4A7C15ULL;
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+	return z ^ (z >> 31);
+}
+
+/* integer elements in [0, 99), mapped from the top 32 bits with a multiply instead of a modulo */
+static inline int matrix_value(int row, int col)
+{
+	return (int)(((matrix_bits(row, col) >> 32) * 99) >> 32);
+}
+
+/* floating point elements in [0, 99) */
+static inline double matrix_real(int row, int col)
+{
+	return (matrix_bits(row, col) >> 11) * 0x1.0p-53 * 99.0;
+}
+
+/* fill row i of the matrix */
+void fill_row(void *row, int i)
+{
+#define FILL(T, value)                  \
+	for (int j = 0; j < size; j++)      \
+		((T *)row)[j] = (T)value(i, j); \
+	break
+
+	switch (elemType)
+	{
+	case ELEM_INT8:
+		FILL(int8_t, matrix_value);
+	case ELEM_INT16:
+		FILL(int16_t, matrix_value);
+	case ELEM_INT32:
+		FILL(int32_t, matrix_value);
+	case ELEM_INT64:
+		FILL(int64_t, matrix_value);
+	case ELEM_FLOAT:
+		FILL(float, matrix_real);
+	default:
+		FILL(double, matrix_real);
+	}
+#undef FILL
+}
+
+/* fill worker myid's strip; running this on the worker that later reduces
+   the strip puts its pages on that worker's NUMA node */
+void *InitWorker(void *arg)
+{
+	long myid = (long)arg;
+
+	pin_worker(myid);
+	for (int i = strip_begin(myid); i < strip_begin(myid + 1); i++)
+		fill_row(matrix_row(i), i);
+	return NULL;
+}
+
+/* initialize the matrix with numWorkers workers, one strip each,
+   returns the elapsed time */
+double init_matrix()
+{
+	long l;
+	pthread_t *workerid = malloc(numWorkers * sizeof(pthread_t));
+	double start = read_timer();
+
+	for (l = 0; l < numWorkers; l++)
+		pthread_create(&workerid[l], &attr, InitWorker, (void *)l);
+	for (l = 0; l < numWorkers; l++)
+		pthread_join(workerid[l], NULL);
+	free(workerid);
+	return read_timer() - start;
+}
+
+/* reduction operators: every operator keeps a partial state per worker,
+   folds whole rows into it and combines two states associatively, so any
+   set of operators can be computed in one pass over the matrix */
+typedef struct ReduceOp
+{
+	const char *name;
+	size_t (*state_size)(const struct ReduceOp *op);
+	void (*init)(const struct ReduceOp *op, void *state);
+	void (*row)(const struct ReduceOp *op, void *state, const void *row, int i);
+	void (*chunk)(const struct ReduceOp *op, void *state, int first, int last); /* replaces row when set */
+	void (*combine)(const struct ReduceOp *op, void *into, const void *from);
+	void (*print)(const struct ReduceOp *op, void *state);
+	int param;	   /* histogram bins or top-k count */
+	double lo, hi; /* histogram range */
+} ReduceOp;
+
+/* expand body(x, f) for every element x of a row of n elements, where f is
+   the Value field matching the element type, i for integers and f for
+   floating point; the column is available as j */
+#define FOR_EACH_AS(T, f, row, n, body)    \
+	{                                      \
+		const T *e_ = (const T *)(row);    \
+		for (int j = 0; j < (n); j++)      \
+			body(e_[j], f);                \
+	}
+#define FOR_EACH_ELEMENT(row, n, body)               \
+	switch (elemType)                                \
+	{                                                \
+	case ELEM_INT8:                                  \
+		FOR_EACH_AS(int8_t, i, row, n, body) break;  \
+	case ELEM_INT16:                                 \
+		FOR_EACH_AS(int16_t, i, row, n, body) break; \
+	case ELEM_INT32:                                 \
+		FOR_EACH_AS(int32_t, i, row, n, body) break; \
+	case ELEM_INT64:                                 \
+		FOR_EACH_AS(int64_t, i, row, n, body) break; \
+	case ELEM_FLOAT:                                 \
+		FOR_EACH_AS(float, f, row, n, body) break;   \
+	default:                                         \
+		FOR_EACH_AS(double, f, row, n, body) break;  \
+	}
+
+/* add x to the field f of the Value v points to, picked by pasting the field
+   name: integers add through uint64 so they wrap instead of overflowing,
+   floating point adds in double; the squares are taken the same way */
+#define VALUE_ADD_i(v, x) ((v)->i = (int64_t)((uint64_t)(v)->i + (uint64_t)(x)))
+#define VALUE_ADD_f(v, x) ((v)->f += (double)(x))
+#define VALUE_SQUARE_i(x) ((uint64_t)(x) * (uint64_t)(x))
+#define VALUE_SQUARE_f(x) ((double)(x) * (double)(x))
+
+void value_combine(const ReduceOp *op, void *into, const void *from)
+{
+	(void)op;
+	if (IS_FLOAT_TYPE(elemType))
+		VALUE_ADD_f((Value *)into, ((const Value *)from)->f);
+	else
+		VALUE_ADD_i((Value *)into, ((const Value *)from)->i);
+}
+
+/* minmax: sum, min, max and their positions through the row kernels; NaN
+   has no order, so the kernels skip it for min and max unless it is the
+   first element of a row, which seeds that row's min and max with NaN and
+   position 0, and a NaN result sticks once it is the first merged into an
+   accumulator: a matrix starting with NaN reports nan at (0,0); any NaN
+   element makes the sum nan */
+size_t minmax_state_size(const ReduceOp *op)
+{
+	(void)op;
+	return sizeof(WorkerResult);
+}
+
+void minmax_init(const ReduceOp *op, void *state)
+{
+	(void)op;
+	init_result(state);
+}
+
+void minmax_row(const ReduceOp *op, void *state, const void *row, int i)
+{
+	WorkerResult r;
+
+	(void)op;
+	row_kernel(row, size, &r);
+	merge_result(state, &r, (long)i * size);
+}
+
+void minmax_combine(const ReduceOp *op, void *into, const void *from)
+{
+	(void)op;
+	merge_result(into, from, 0);
+}
+
+void minmax_print(const ReduceOp *op, void *state)
+{
+	WorkerResult *result = state;
+
+	(void)op;
+	if (IS_FLOAT_TYPE(elemType))
+		result->sum.f -= result->comp;
+	printf("Global max: ");
+	print_value(stdout, result->max);
+	printf(" (%ld,%ld)\n", result->max_pos / size, result->max_pos % size);
+	printf("Global min: ");
+	print_value(stdout, result->min);
+	printf(" (%ld,%ld)\n", result->min_pos / size, result->min_pos % size);
+	printf("The total is ");
+	print_value(stdout, result->sum);
+	printf("\n");
+}
+
+/* sum and sumsq: plain sum and sum of squares, kept in the sum and comp of
+   a WorkerResult so floating point sums are compensated like minmax's; sum
+   takes its row sums from the row kernels, so both print the same total */
+#define SUM_ADD_i(s, x) VALUE_ADD_i(&(s)->sum, x)
+#define SUM_ADD_f(s, x) kahan_add(&(s)->sum.f, &(s)->comp, x)
+#define SUM_BODY(x, f) SUM_ADD_##f(s, x)
+#define SUMSQ_BODY(x, f) SUM_ADD_##f(s, VALUE_SQUARE_##f(x))
+
+size_t sum_state_size(const ReduceOp *op)
+{
+	(void)op;
+	return sizeof(WorkerResult);
+}
+
+void sum_init(const ReduceOp *op, void *state)
+{
+	(void)op;
+	memset(state, 0, sizeof(WorkerResult));
+}
+
+void sum_row(const ReduceOp *op, void *state, const void *row, int i)
+{
+	WorkerResult r;
+
+	(void)op;
+	(void)i;
+	row_kernel(row, size, &r);
+	add_sum(state, r.sum);
+}
+
+void sumsq_row(const ReduceOp *op, void *state, const void *row, int i)
+{
+	WorkerResult *s = state;
+
+	(void)op;
+	(void)i;
+	FOR_EACH_ELEMENT(row, size, SUMSQ_BODY)
+}
+
+void sum_combine(const ReduceOp *op, void *into, const void *from)
+{
+	const WorkerResult *f = from;
+
+	(void)op;
+	add_sum(into, f->sum);
+	if (IS_FLOAT_TYPE(elemType))
+		add_sum(into, (Value){.f = -f->comp});
+}
+
+void sum_print(const ReduceOp *op, void *state)
+{
+	WorkerResult *s = state;
+
+	if (IS_FLOAT_TYPE(elemType))
+		s->sum.f -= s->comp;
+	printf("%s: ", strcmp(op->name, "sumsq") == 0 ? "Sum of squares" : "Sum");
+	print_value(stdout, s->sum);
+	printf("\n");
+}
+
+/* hist:lo:hi:bins: counts per equal-width bin of [lo, hi) plus one count
+   below and one at or above the range, and one for NaN elements */
+size_t hist_state_size(const ReduceOp *op)
+{
+	return (op->param + 3) * sizeof(long);
+}
+
+void hist_init(const ReduceOp *op, void *state)
+{
+	memset(state, 0, hist_state_size(op));
+}
+
+/* the count an element goes to; a value just below hi may round up to
+   param, so the bin is clamped to the data bins */
+static inline int hist_bin(const ReduceOp *op, double scale, double x)
+{
+	if (isnan(x))
+		return op->param + 2;
+	if (x < op->lo)
+		return 0;
+	if (x >= op->hi)
+		return op->param + 1;
+
+	int bin = 1 + (int)((x - op->lo) * scale);
+	return bin < 1 ? 1 : bin > op->param ? op->param : bin;
+}
+
+#define HIST_BODY(x, f) counts[hist_bin(op, scale, (double)(x))]++
+
+void hist_row(const ReduceOp *op, void *state, const void *row, int i)
+{
+	long *counts = state;
+	double scale = op->param / (op->hi - op->lo);
+
+	(void)i;
+	FOR_EACH_ELEMENT(row, size, HIST_BODY)
+}
+
+void hist_combine(const ReduceOp *op, void *into, const void *from)
+{
+	for (int b = 0; b < op->param + 3; b++)
+		((long *)into)[b] += ((const long *)from)[b];
+}
+
+void hist_print(const ReduceOp *op, void *state)
+{
+	long *counts = state;
+	double width = (op->hi - op->lo) / op->param;
+
+	printf("Histogram:\n");
+	printf("  below %g: %ld\n", op->lo, counts[0]);
+	for (int b = 0; b < op->param; b++)
+		printf("  [%g, %g): %ld\n", op->lo + b * width, op->lo + (b + 1) * width, counts[b + 1]);
+	printf("  from %g: %ld\n", op->hi, counts[op->param + 1]);
+	if (counts[op->param + 2] > 0)
+		printf("  NaN: %ld\n", counts[op->param + 2]);
+}
+
+/* topk:k: the k largest elements with their positions, kept as a min-heap
+   ordered by value and then by descending position, so the first
+   occurrence wins ties */
+typedef struct
+{
+	int count;
+	struct
+	{
+		Value value;
+		long pos;
+	} items[];
+} TopK;
+
+size_t topk_state_size(const ReduceOp *op)
+{
+	return sizeof(TopK) + op->param * sizeof(((TopK *)0)->items[0]);
+}
+
+void topk_init(const ReduceOp *op, void *state)
+{
+	(void)op;
+	((TopK *)state)->count = 0;
+}
+
+/* whether item a of the heap ranks below item b */
+static inline bool topk_below(const TopK *t, int a, int b)
+{
+	return value_less(t->items[a].value, t->items[b].value) ||
+		   (value_equal(t->items[a].value, t->items[b].value) && t->items[a].pos > t->items[b].pos);
+}
+
+void topk_swap(TopK *t, int a, int b)
+{
+	typeof(t->items[0]) tmp = t->items[a];
+	t->items[a] = t->items[b];
+	t->items[b] = tmp;
+}
+
+/* offer one element to the heap */
+void topk_push(const ReduceOp *op, TopK *t, Value v, long pos)
+{
+	int i;
+
+	if (t->count < op->param)
+	{
+		i = t->count++;
+		t->items[i].value = v;
+		t->items[i].pos = pos;
+		for (; i > 0 && topk_below(t, i, (i - 1) / 2); i = (i - 1) / 2)
+			topk_swap(t, i, (i - 1) / 2);
+		return;
+	}
+
+	/* replace the root if the new element ranks above it, then sift down */
+	if (value_less(v, t->items[0].value) || (value_equal(v, t->items[0].value) && pos > t->items[0].pos))
+		return;
+	t->items[0].value = v;
+	t->items[0].pos = pos;
+	for (i = 0;;)
+	{
+		int smallest = i, l = 2 * i + 1, r = 2 * i + 2;
+		if (l < t->count && topk_below(t, l, smallest))
+			smallest = l;
+		if (r < t->count && topk_below(t, r, smallest))
+			smallest = r;
+		if (smallest == i)
+			break;
+		topk_swap(t, i, smallest);
+		i = smallest;
+	}
+}
+
+/* cheap pre-check against the root so most elements never touch the heap;
+   NaN is skipped like hist counts it apart, since it has no place in the
+   order and at the root it would make every later element fail the check */
+#define TOPK_BODY(x, f)                                                               \
+	if (!isnan((double)(x)) && (t->count < op->param || (x) >= t->items[0].value.f)) \
+	topk_push(op, t, (Value){.f = (x)}, base + j)
+
+void topk_row(const ReduceOp *op, void *state, const void *row, int i)
+{
+	TopK *t = state;
+	long base = (long)i * size;
+
+	FOR_EACH_ELEMENT(row, size, TOPK_BODY)
+}
+
+void topk_combine(const ReduceOp *op, void *into, const void *from)
+{
+	const TopK *f = from;
+
+	for (int i = 0; i < f->count; i++)
+		topk_push(op, into, f->items[i].value, f->items[i].pos);
+}
+
+void topk_print(const ReduceOp *op, void *state)
+{
+	TopK *t = state;
+
+	/* k is small, a selection sort into descending order is enough */
+	for (int i = 0; i < t->count; i++)
+		for (int j = i + 1; j < t->count; j++)
+			if (topk_below(t, i, j))
+				topk_swap(t, i, j);
+
+	printf("Top %d:", op->param);
+	for (int i = 0; i < t->count; i++)
+	{
+		printf(" ");
+		print_value(stdout, t->items[i].value);
+		printf(" (%ld,%ld)", t->items[i].pos / size, t->items[i].pos % size);
+	}
+	printf("\n");
+}
+
+/* rowsums: every row is reduced by exactly one worker, so the sums go
+   straight into one shared array and there is nothing to combine */
+Value *rowSums;
+
+size_t rowsums_state_size(const ReduceOp *op)
+{
+	(void)op;
+	return 0;
+}
+
+void rowsums_init(const ReduceOp *op, void *state)
+{
+	(void)op;
+	(void)state;
+}
+
+void rowsums_row(const ReduceOp *op, void *state, const void *row, int i)
+{
+	WorkerResult sum = {0}, *s = &sum;
+
+	(void)op;
+	(void)state;
+	FOR_EACH_ELEMENT(row, size, SUM_BODY)
+	if (IS_FLOAT_TYPE(elemType))
+		sum.sum.f -= sum.comp;
+	rowSums[i - firstRow] = sum.sum;
+}
+
+void rowsums_combine(const ReduceOp *op, void *into, const void *from)
+{
+	(void)op;
+	(void)into;
+	(void)from;
+}
+
+#define PRINTSUMS 8 /* row and column sums printed before eliding the rest */
+
+void print_sums(const char *title, const Value *sums, int n)
+{
+	printf("%s (%d):", title, n);
+	for (int i = 0; i < n && i < PRINTSUMS; i++)
+	{
+		printf(" ");
+		print_value(stdout, sums[i]);
+	}
+	printf(n > PRINTSUMS ? " ...\n" : "\n");
+}
+
+void rowsums_print(const ReduceOp *op, void *state)
+{
+	(void)op;
+	(void)state;
+	print_sums("Row sums", rowSums, rows);
+}
+
+/* colsums: every worker keeps its own column sums, added up when combined */
+size_t colsums_state_size(const ReduceOp *op)
+{
+	(void)op;
+	return size * sizeof(Value);
+}
+
+void colsums_init(const ReduceOp *op, void *state)
+{
+	memset(state, 0, colsums_state_size(op));
+}
+
+#define COLSUMS_BODY(x, f) VALUE_ADD_##f(&s[j], x)
+
+void colsums_row(const ReduceOp *op, void *state, const void *row, int i)
+{
+	Value *s = state;
+
+	(void)op;
+	(void)i;
+	FOR_EACH_ELEMENT(row, size, COLSUMS_BODY)
+}
+
+void colsums_combine(const ReduceOp *op, void *into, const void *from)
+{
+	for (int j = 0; j < size; j++)
+		value_combine(op, (Value *)into + j, (const Value *)from + j);
+}
+
+void colsums_print(const ReduceOp *op, void *state)
+{
+	(void)op;
+	print_sums("Column sums", state, size);
+}
+
+/* tiled: global, per-row and per-column sum, min and max in one cache
+   blocked pass; a worker walks its chunk TILECOLS columns at a time, so
+   the column accumulators of the tile stay in L1 while the chunk's rows
+   stream past, and row aggregates go straight into one shared array since
+   every row belongs to a single chunk */
+#define TILECOLS 512 /* columns per tile, 4 accumulators of 8 bytes each per column */
+
+typedef struct
+{
+	Value sum, min, max;
+	int min_col, max_col; /* first occurrence in the row */
+	double comp;		  /* Kahan compensation of a floating point sum, as in WorkerResult */
+} RowStats;
+
+RowStats *rowStats;
+const char *resultsPath; /* binary file the tiled aggregates are written to, NULL for none */
+
+/* the state is four arrays of size columns: sums, minimums, maximums and
+   the Kahan compensations of floating point sums */
+size_t tiled_state_size(const ReduceOp *op)
+{
+	(void)op;
+	return 3 * size * sizeof(Value) + size * sizeof(double);
+}
+
+void tiled_init(const ReduceOp *op, void *state)
+{
+	Value *sum = state, *min = sum + size, *max = min + size;
+	double *comp = (double *)(max + size);
+
+	(void)op;
+	for (int j = 0; j < size; j++)
+	{
+		comp[j] = 0;
+		if (IS_FLOAT_TYPE(elemType))
+		{
+			sum[j].f = 0;
+			min[j].f = __builtin_inf();
+			max[j].f = -__builtin_inf();
+		}
+		else
+		{
+			sum[j].i = 0;
+			min[j].i = INT64_MAX;
+			max[j].i = INT64_MIN;
+		}
+	}
+}
+
+/* add x to the sum of column j, wrapping for integers and Kahan compensated
+   for floating point like SUM_ADD */
+#define TILE_COL_ADD_i(j, x) VALUE_ADD_i(&colSum[j], x)
+#define TILE_COL_ADD_f(j, x) kahan_add(&colSum[j].f, &colComp[j], x)
+
+/* tiled pass over rows [first, last) for element type T, using Value field f */
+#define TILE_KERNEL(name, T, f)                                              \
+	void name(Value *colSum, Value *colMin, Value *colMax, double *colComp,  \
+			  int first, int last)                                           \
+	{                                                                        \
+		(void)colComp; /* only floating point sums are compensated */        \
+		for (int i = first; i < last; i++)                                   \
+		{                                                                    \
+			const T *row = matrix_row(i);                                    \
+			RowStats *rs = &rowStats[i - firstRow];                          \
+			rs->sum.f = 0;                                                   \
+			rs->comp = 0;                                                    \
+			rs->min.f = rs->max.f = row[0];                                  \
+			rs->min_col = rs->max_col = 0;                                   \
+		}                                                                    \
+		for (int j0 = 0; j0 < size; j0 += TILECOLS)                          \
+		{                                                                    \
+			int j1 = (j0 + TILECOLS < size) ? j0 + TILECOLS : size;          \
+			for (int i = first; i < last; i++)                               \
+			{                                                                \
+				const T *row = matrix_row(i);                                \
+				RowStats *rs = &rowStats[i - firstRow];                      \
+				WorkerResult acc = {.sum = rs->sum, .comp = rs->comp};       \
+				WorkerResult *s = &acc;                                      \
+				T min = rs->min.f, max = rs->max.f;                          \
+				int min_col = rs->min_col, max_col = rs->max_col;            \
+				for (int j = j0; j < j1; j++)                                \
+				{                                                            \
+					T x = row[j];                                            \
+					SUM_ADD_##f(s, x);                                       \
+					if (x > max)                                             \
+					{                                                        \
+						max = x;                                             \
+						max_col = j;                                         \
+					}                                                        \
+					if (x < min)                                             \
+					{                                                        \
+						min = x;                                             \
+						min_col = j;                                         \
+					}                                                        \
+					TILE_COL_ADD_##f(j, x);                                  \
+					if (x < colMin[j].f)                                     \
+						colMin[j].f = x;                                     \
+					if (x > colMax[j].f)                                     \
+						colMax[j].f = x;                                     \
+				}                                                            \
+				rs->sum = acc.sum;                                           \
+				rs->comp = acc.comp;                                         \
+				rs->min.f = min;                                             \
+				rs->max.f = max;                                             \
+				rs->min_col = min_col;                                       \
+				rs->max_col = max_col;                                       \
+			}                                                                \
+		}                                                                    \
+	}
+
+TILE_KERNEL(tile_int8, int8_t, i)
+TILE_KERNEL(tile_int16, int16_t, i)
+TILE_KERNEL(tile_int32, int32_t, i)
+TILE_KERNEL(tile_int64, int64_t, i)
+TILE_KERNEL(tile_float, float, f)
+TILE_KERNEL(tile_double, double, f)
+
+void tiled_chunk(const ReduceOp *op, void *state, int first, int last)
+{
+	Value *sum = state, *min = sum + size, *max = min + size;
+	double *comp = (double *)(max + size);
+
+	(void)op;
+	switch (elemType)
+	{
+	case ELEM_INT8:
+		tile_int8(sum, min, max, comp, first, last);
+		break;
+	case ELEM_INT16:
+		tile_int16(sum, min, max, comp, first, last);
+		break;
+	case ELEM_INT32:
+		tile_int32(sum, min, max, comp, first, last);
+		break;
+	case ELEM_INT64:
+		tile_int64(sum, min, max, comp, first, last);
+		break;
+	case ELEM_FLOAT:
+		tile_float(sum, min, max, comp, first, last);
+		break;
+	default:
+		tile_double(sum, min, max, comp, first, last);
+		break;
+	}
+}
+
+void tiled_combine(const ReduceOp *op, void *into, const void *from)
+{
+	Value *sum = into, *min = sum + size, *max = min + size;
+	const Value *fsum = from, *fmin = fsum + size, *fmax = fmin + size;
+	double *comp = (double *)(max + size);
+	const double *fcomp = (const double *)(fmax + size);
+
+	for (int j = 0; j < size; j++)
+	{
+		if (IS_FLOAT_TYPE(elemType))
+		{
+			kahan_add(&sum[j].f, &comp[j], fsum[j].f);
+			kahan_add(&sum[j].f, &comp[j], -fcomp[j]);
+		}
+		else
+			value_combine(op, &sum[j], &fsum[j]);
+		if (value_less(fmin[j], min[j]))
+			min[j] = fmin[j];
+		if (value_less(max[j], fmax[j]))
+			max[j] = fmax[j];
+	}
+}
+
+/* write the aggregates as a compact binary file, all little endian:
+     char magic[8] = "MSUMTILE", int32 elemType, int32 rows, int32 columns,
+     Value sum, min, max, int64 min_pos, max_pos        global
+     rows x (Value sum, min, max, int32 min_col, max_col)
+     columns x (Value sum, min, max)
+   where Value is an int64 for integer types and a double otherwise */
+bool write_results(const char *path, const WorkerResult *global, const Value *colSum,
+				   const Value *colMin, const Value *colMax)
+{
+	FILE *out = fopen(path, "wb");
+	int32_t header[3] = {elemType, rows, size};
+	int64_t pos[2] = {global->min_pos, global->max_pos};
+
+	if (out == NULL)
+		return false;
+	fwrite("MSUMTILE", 1, 8, out);
+	fwrite(header, sizeof(int32_t), 3, out);
+	fwrite(&global->sum, sizeof(Value), 1, out);
+	fwrite(&global->min, sizeof(Value), 1, out);
+	fwrite(&global->max, sizeof(Value), 1, out);
+	fwrite(pos, sizeof(int64_t), 2, out);
+	for (int i = 0; i < rows; i++)
+	{
+		int32_t cols[2] = {rowStats[i].min_col, rowStats[i].max_col};
+		fwrite(&rowStats[i], sizeof(Value), 3, out);
+		fwrite(cols, sizeof(int32_t), 2, out);
+	}
+	for (int j = 0; j < size; j++)
+	{
+		fwrite(&colSum[j], sizeof(Value), 1, out);
+		fwrite(&colMin[j], sizeof(Value), 1, out);
+		fwrite(&colMax[j], sizeof(Value), 1, out);
+	}
+	bool ok = !ferror(out);
+	return fclose(out) == 0 && ok;
+}
+
+void tiled_print(const ReduceOp *op, void *state)
+{
+	Value *sum = state, *min = sum + size, *max = min + size;
+	double *comp = (double *)(max + size);
+	Value *sums = malloc(rows * sizeof(Value));
+	WorkerResult global, row;
+
+	/* settle the compensated sums, then the global aggregates follow from
+	   the row aggregates */
+	if (IS_FLOAT_TYPE(elemType))
+	{
+		for (int j = 0; j < size; j++)
+			sum[j].f -= comp[j];
+		for (int i = 0; i < rows; i++)
+			rowStats[i].sum.f -= rowStats[i].comp;
+	}
+	init_result(&global);
+	for (int i = 0; i < rows; i++)
+	{
+		row.sum = rowStats[i].sum;
+		row.comp = 0;
+		row.min = rowStats[i].min;
+		row.max = rowStats[i].max;
+		row.min_pos = rowStats[i].min_col;
+		row.max_pos = rowStats[i].max_col;
+		merge_result(&global, &row, (long)(firstRow + i) * size);
+		sums[i] = rowStats[i].sum;
+	}
+	if (IS_FLOAT_TYPE(elemType))
+		global.sum.f -= global.comp;
+	global.comp = 0;
+
+	minmax_print(op, &global);
+	print_sums("Row sums", sums, rows);
+	print_sums("Column sums", sum, size);
+	print_sums("Column minimums", min, size);
+	print_sums("Column maximums", max, size);
+	free(sums);
+
+	if (resultsPath != NULL && !write_results(resultsPath, &global, sum, min, max))
+		fprintf(stderr, "Could not write %s\n", resultsPath);
+}
+
+const ReduceOp opTemplates[] = {
+	{"minmax", minmax_state_size, minmax_init, minmax_row, NULL, minmax_combine, minmax_print, 0, 0, 0},
+	{"sum", sum_state_size, sum_init, sum_row, NULL, sum_combine, sum_print, 0, 0, 0},
+	{"sumsq", sum_state_size, sum_init, sumsq_row, NULL, sum_combine, sum_print, 0, 0, 0},
+	{"hist", hist_state_size, hist_init, hist_row, NULL, hist_combine, hist_print, 10, 0, 100},
+	{"topk", topk_state_size, topk_init, topk_row, NULL, topk_combine, topk_print, 10, 0, 0},
+	{"rowsums", rowsums_state_size, rowsums_init, rowsums_row, NULL, rowsums_combine, rowsums_print, 0, 0, 0},
+	{"colsums", colsums_state_size, colsums_init, colsums_row, NULL, colsums_combine, colsums_print, 0, 0, 0},
+	{"tiled", tiled_state_size, tiled_init, NULL, tiled_chunk, tiled_combine, tiled_print, 0, 0, 0},
+};
+#define NUM_OP_TEMPLATES (int)(sizeof(opTemplates) / sizeof(opTemplates[0]))
+
+ReduceOp *ops; /* operators computed by every reduction */
+int numOps;
+
+/* parse a comma separated operator list such as "minmax,hist:0:100:20,topk:5" */
+bool parse_ops(char *spec)
+{
+	char *save, *tok;
+
+	numOps = 0;
+	ops = realloc(ops, (strlen(spec) / 2 + 1) * sizeof(ReduceOp));
+	for (tok = strtok_r(spec, ",", &save); tok != NULL; tok = strtok_r(NULL, ",", &save))
+	{
+		char *params = strchr(tok, ':');
+		int t;
+
+		if (params != NULL)
+			*params++ = '\0';
+		for (t = 0; t < NUM_OP_TEMPLATES && strcmp(tok, opTemplates[t].name) != 0; t++)
+			;
+		if (t == NUM_OP_TEMPLATES)
+			return false;
+		ops[numOps] = opTemplates[t];
+		if (params != NULL && strcmp(tok, "hist") == 0)
+		{
+			if (sscanf(params, "%lf:%lf:%d", &ops[numOps].lo, &ops[numOps].hi, &ops[numOps].param) < 2 ||
+				!(ops[numOps].lo < ops[numOps].hi))
+				return false;
+		}
+		else if (params != NULL && sscanf(params, "%d", &ops[numOps].param) != 1)
+			return false;
+		if ((strcmp(tok, "hist") == 0 || strcmp(tok, "topk") == 0) && ops[numOps].param < 1)
+			return false;
+		numOps++;
+	}
+	return numOps > 0;
+}
+
+/* the reduction engine: a pool of numWorkers persistent workers, each with
+   its own cache line aligned block of operator states; a reduction folds
+   the rows every worker claims into its states, and the states are then
+   combined as a binary tree, so worker 0 ends up holding the result */
+#define CACHELINE 64
+
+size_t *opOffsets;	/* offset of each operator's state inside a worker's block */
+size_t stateStride; /* bytes of one worker's block, a multiple of CACHELINE */
+char **states;		/* one block per worker */
+
+pthread_t *pool;
+int poolSize = 0;
+pthread_mutex_t poolLock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t poolStart = PTHREAD_COND_INITIALIZER; /* a new reduction has been posted */
+pthread_cond_t poolDone = PTHREAD_COND_INITIALIZER;	 /* every worker finished the reduction */
+int poolGeneration = 0;								 /* number of reductions posted */
+int poolFinished;									 /* workers done with the current reduction */
+bool poolExit = false;
+BarrierKind barrierKind = BARRIER_SENSE;
+Barrier poolBarrier; /* separates the combine rounds */
+
+static inline void *op_state(long worker, int op)
+{
+	return states[worker] + opOffsets[op];
+}
+
+/* lay the operator states out in a block, every state on its own cache lines */
+void layout_states()
+{
+	opOffsets = realloc(opOffsets, numOps * sizeof(size_t));
+	stateStride = 0;
+	for (int o = 0; o < numOps; o++)
+	{
+		opOffsets[o] = stateStride;
+		stateStride += (ops[o].state_size(&ops[o]) + CACHELINE - 1) & ~(size_t)(CACHELINE - 1);
+	}
+	if (stateStride == 0)
+		stateStride = CACHELINE;
+}
+
+/* start numWorkers pool workers with fresh state blocks */
+void start_pool()
+{
+	long l;
+
+	layout_states();
+	states = malloc(numWorkers * sizeof(char *));
+	for (l = 0; l < numWorkers; l++)
+		states[l] = aligned_alloc(CACHELINE, stateStride);
+
+	barrier_init(&poolBarrier, barrierKind, numWorkers);
+	poolExit = false;
+	poolSize = numWorkers;
+	pool = malloc(poolSize * sizeof(pthread_t));
+	for (l = 0; l < poolSize; l++)
+		pthread_create(&pool[l], &attr, Worker, (void *)l);
+}
+
+/* stop the pool workers and free their states */
+void stop_pool()
+{
+	pthread_mutex_lock(&poolLock);
+	poolExit = true;
+	pthread_cond_broadcast(&poolStart);
+	pthread_mutex_unlock(&poolLock);
+
+	for (long l = 0; l < poolSize; l++)
+	{
+		pthread_join(pool[l], NULL);
+		free(states[l]);
+	}
+	free(states);
+	free(pool);
+	poolSize = 0;
+	barrier_destroy(&poolBarrier);
+}
+
+/* run one reduction of the matrix on the pool, the result is left in the
+   states of worker 0; returns the elapsed time */
+double reduce_matrix()
+{
+	atomic_store(&next_row_counter, firstRow);
+
+	/* do the parallel work: wake the workers */
+	start_time = read_timer();
+	pthread_mutex_lock(&poolLock);
+	poolFinished = 0;
+	poolGeneration++;
+	pthread_cond_broadcast(&poolStart);
+	while (poolFinished < poolSize)
+		pthread_cond_wait(&poolDone, &poolLock);
+	pthread_mutex_unlock(&poolLock);
+
+	/* get end time */
+	end_time = read_timer();
+	return end_time - start_time;
+}
+
+/* time every dispatch mode for 1, 2, 4, ... numWorkers threads,
+   speedup is relative to the single threaded static run */
+void run_benchmark()
+{
+	int maxWorkers = numWorkers;
+	double base = 0;
+
+	printf("type: %s, kernel: %s\n", elemNames[elemType], elemType == ELEM_INT32 ? kernelNames[kernelIndex] : "scalar");
+	printf("%-8s %8s %6s %12s %8s\n", "dispatch", "workers", "chunk", "time (sec)", "speedup");
+	for (int mode = 0; mode < NUM_DISPATCH_MODES; mode++)
+	{
+		dispatchMode = mode;
+		for (numWorkers = 1;; numWorkers = (numWorkers * 2 < maxWorkers) ? numWorkers * 2 : maxWorkers)
+		{
+			double best = 0;
+			start_pool();
+			for (int run = 0; run < BENCHRUNS; run++)
+			{
+				double t = reduce_matrix();
+				if (run == 0 || t < best)
+					best = t;
+			}
+			stop_pool();
+			if (base == 0)
+				base = best;
+			printf("%-8s %8d %6d %12.6f %8.2f\n", dispatchNames[mode], numWorkers,
+				   mode == DISPATCH_STATIC ? rows / numWorkers : mode == DISPATCH_MUTEX ? 1 : chunkSize,
+				   best, base / best);
+			if (numWorkers == maxWorkers)
+				break;
+		}
+	}
+	numWorkers = maxWorkers;
+}
+
+Barrier benchBarrier;
+double barrierTime; /* time of BARRIERROUNDS episodes measured by thread 0 */
+
+void *BarrierBenchWorker(void *arg)
+{
+	long myid = (long)arg;
+
+	pin_worker(myid);
+	barrier_wait(&benchBarrier, myid);
+	double start = read_timer();
+	for (int round = 0; round < BARRIERROUNDS; round++)
+		barrier_wait(&benchBarrier, myid);
+	if (myid == 0)
+		barrierTime = read_timer() - start;
+	return NULL;
+}
+
+/* time every barrier kind for 1, 2, 4, ... numWorkers threads */
+void run_barrier_benchmark()
+{
+	int maxWorkers = numWorkers;
+
+	printf("%-14s %8s %14s\n", "barrier", "workers", "latency (us)");
+	for (int kind = 0; kind < NUM_BARRIER_KINDS; kind++)
+	{
+		for (numWorkers = 1;; numWorkers = (numWorkers * 2 < maxWorkers) ? numWorkers * 2 : maxWorkers)
+		{
+			pthread_t *workerid = malloc(numWorkers * sizeof(pthread_t));
+			long l;
+
+			barrier_init(&benchBarrier, kind, numWorkers);
+			for (l = 0; l < numWorkers; l++)
+				pthread_create(&workerid[l], &attr, BarrierBenchWorker, (void *)l);
+			for (l = 0; l < numWorkers; l++)
+				pthread_join(workerid[l], NULL);
+			barrier_destroy(&benchBarrier);
+			free(workerid);
+
+			printf("%-14s %8d %14.3f\n", barrierNames[kind], numWorkers, 1e6 * barrierTime / BARRIERROUNDS);
+			if (numWorkers == maxWorkers)
+				break;
+		}
+	}
+	numWorkers = maxWorkers;
+}
+
+/* map or generate rows [firstRow, firstRow + rows) of the matrix, writing
+   them to outputPath when given; returns the initialization time */
+double load_matrix(const char *outputPath)
+{
+	double init_time = 0;
+
+	if (numWorkers > rows)
+		numWorkers = rows;
+	if (inputPath != NULL)
+	{
+		matrix = map_matrix_file(inputPath);
+		if (matrix == NULL)
+		{
+			fprintf(stderr, "Could not map %s as a matrix with %d columns\n", inputPath, size);
+			exit(1);
+		}
+	}
+	else
+	{
+		matrix = alloc_matrix((size_t)rows * size * elemSizes[elemType]);
+		if (matrix == NULL)
+		{
+			fprintf(stderr, "Could not allocate a %dx%d matrix\n", rows, size);
+			exit(1);
+		}
+
+		/* initialize the matrix, every worker first-touches its own strip */
+		init_time = init_matrix();
+
+		if (outputPath != NULL && !write_matrix_file(outputPath))
+		{
+			fprintf(stderr, "Could not write %s\n", outputPath);
+			exit(1);
+		}
+	}
+
+	rowSums = malloc(rows * sizeof(Value));
+	rowStats = malloc(rows * sizeof(RowStats));
+	return init_time;
+}
+
+/* distributed reduction: with --procs the coordinator forks one shard
+   process per band of rows; every shard connects back over a socket, is
+   told its band, reduces it with its own worker pool and replies with the
+   state block of its worker 0, which the coordinator combines as a tree the
+   same way the pool combines its workers; all processes run this binary,
+   so the messages are sent as raw structs */
+int numProcs = 0;			 /* shard processes, 0 to reduce in this process */
+const char *socketAddress; /* unix:path or tcp:[host:]port */
+
+typedef struct
+{
+	int32_t first_row;
+	int32_t rows;
+} ShardRequest;
+
+/* followed by state_bytes bytes of operator states */
+typedef struct
+{
+	int32_t first_row;
+	int32_t rows;
+	double init_time;
+	double reduce_time;
+	uint64_t state_bytes;
+} ShardReply;
+
+bool read_full(int fd, void *buf, size_t n)
+{
+	for (size_t done = 0; done < n;)
+	{
+		ssize_t r = read(fd, (char *)buf + done, n - done);
+		if (r <= 0)
+			return false;
+		done += r;
+	}
+	return true;
+}
+
+bool write_full(int fd, const void *buf, size_t n)
+{
+	for (size_t done = 0; done < n;)
+	{
+		ssize_t r = write(fd, (const char *)buf + done, n - done);
+		if (r <= 0)
+			return false;
+		done += r;
+	}
+	return true;
+}
+
+/* open a stream socket on address, bound and listening for the coordinator
+   or connected for a shard; returns -1 on failure */
+int open_socket(const char *address, bool listening)
+{
+	struct sockaddr_storage sa;
+	socklen_t len;
+	int fd, one = 1;
+
+	memset(&sa, 0, sizeof(sa));
+	if (strncmp(address, "unix:", 5) == 0)
+	{
+		struct sockaddr_un *un = (struct sockaddr_un *)&sa;
+
+		if (strlen(address + 5) >= sizeof(un->sun_path))
+			return -1;
+		un->sun_family = AF_UNIX;
+		strcpy(un->sun_path, address + 5);
+		len = sizeof(*un);
+		if (listening)
+			unlink(un->sun_path);
+	}
+	else if (strncmp(address, "tcp:", 4) == 0)
+	{
+		struct sockaddr_in *in = (struct sockaddr_in *)&sa;
+		const char *port = strrchr(address + 4, ':');
+		char host[INET_ADDRSTRLEN] = "127.0.0.1";
+
+		if (port == NULL)
+			port = address + 4;
+		else
+			snprintf(host, sizeof(host), "%.*s", (int)(port++ - (address + 4)), address + 4);
+		in->sin_family = AF_INET;
+		in->sin_port = htons(atoi(port));
+		if (inet_pton(AF_INET, host, &in->sin_addr) != 1)
+			return -1;
+		len = sizeof(*in);
+	}
+	else
+		return -1;
+
+	fd = socket(sa.ss_family, SOCK_STREAM, 0);
+	if (fd < 0)
+		return -1;
+	if (listening)
+	{
+		setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+		if (bind(fd, (struct sockaddr *)&sa, len) != 0 || listen(fd, numProcs) != 0)
+		{
+			close(fd);
+			return -1;
+		}
+	}
+	else if (connect(fd, (struct sockaddr *)&sa, len) != 0)
+	{
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+/* shard process: reduce the band the coordinator assigns and reply with
+   the states; returns the exit status */
+int run_shard(int shard)
+{
+	ShardRequest request;
+	ShardReply reply;
+	int fd = open_socket(socketAddress, false);
+
+	if (fd < 0 || !read_full(fd, &request, sizeof(request)))
+	{
+		fprintf(stderr, "Shard %d could not reach the coordinator at %s\n", shard, socketAddress);
+		return 1;
+	}
+	firstRow = request.first_row;
+	rows = request.rows;
+	firstCpu = shard * numWorkers;
+	reply.first_row = firstRow;
+	reply.rows = rows;
+	reply.init_time = load_matrix(NULL);
+
+	start_pool();
+	reply.reduce_time = reduce_matrix();
+	reply.state_bytes = stateStride;
+	bool ok = write_full(fd, &reply, sizeof(reply)) && write_full(fd, states[0], stateStride);
+	stop_pool();
+
+	close(fd);
+	munmap(matrixBase, matrixBytes);
+	return ok ? 0 : 1;
+}
+
+int compare_doubles(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+	return (x > y) - (x < y);
+}
+
+/* coordinator: fork the shards, hand out the bands, combine the replies as
+   they arrive and report how long every shard took */
+void run_coordinator()
+{
+	char address[128];
+	int listenFd, status;
+	pid_t *pids = malloc(numProcs * sizeof(pid_t));
+	struct pollfd *fds = malloc(numProcs * sizeof(struct pollfd));
+	ShardReply *replies = malloc(numProcs * sizeof(ShardReply));
+	double *sent = malloc(numProcs * sizeof(double));
+	double *wall = malloc(numProcs * sizeof(double));
+	double *sorted = malloc(numProcs * sizeof(double));
+
+	if (socketAddress == NULL)
+	{
+		snprintf(address, sizeof(address), "unix:/tmp/matrixSum.%d.sock", (int)getpid());
+		socketAddress = address;
+	}
+	listenFd = open_socket(socketAddress, true);
+	if (listenFd < 0)
+	{
+		fprintf(stderr, "Could not listen on %s\n", socketAddress);
+		exit(1);
+	}
+	if (strncmp(socketAddress, "tcp:", 4) == 0)
+	{
+		/* tell the shards the port that was actually bound */
+		struct sockaddr_in in;
+		socklen_t len = sizeof(in);
+		char host[INET_ADDRSTRLEN];
+
+		getsockname(listenFd, (struct sockaddr *)&in, &len);
+		inet_ntop(AF_INET, &in.sin_addr, host, sizeof(host));
+		snprintf(address, sizeof(address), "tcp:%s:%d", host, ntohs(in.sin_port));
+		socketAddress = address;
+	}
+
+	/* fork before any thread exists, the shards start from the parsed options */
+	fflush(stdout);
+	for (int p = 0; p < numProcs; p++)
+	{
+		pids[p] = fork();
+		if (pids[p] == 0)
+		{
+			close(listenFd);
+			exit(run_shard(p));
+		}
+	}
+
+	/* bands are handed out in the order the shards connect */
+	double start = read_timer();
+	for (int p = 0; p < numProcs; p++)
+	{
+		struct pollfd listening = {listenFd, POLLIN, 0};
+		ShardRequest request = {(int32_t)((long)p * rows / numProcs), 0};
+
+		while (poll(&listening, 1, 100) < 1)
+		{
+			if (waitpid(-1, &status, WNOHANG) > 0)
+			{
+				fprintf(stderr, "A shard process exited before connecting\n");
+				exit(1);
+			}
+		}
+		fds[p].fd = accept(listenFd, NULL, NULL);
+		fds[p].events = POLLIN;
+		request.rows = (int32_t)((long)(p + 1) * rows / numProcs) - request.first_row;
+		sent[p] = read_timer();
+		if (fds[p].fd < 0 || !write_full(fds[p].fd, &request, sizeof(request)))
+		{
+			fprintf(stderr, "Could not send shard %d its rows\n", p);
+			exit(1);
+		}
+	}
+	close(listenFd);
+	if (strncmp(socketAddress, "unix:", 5) == 0)
+		unlink(socketAddress + 5);
+
+	/* collect the states, timestamping every reply as it arrives */
+	layout_states();
+	states = malloc(numProcs * sizeof(char *));
+	for (int received = 0; received < numProcs;)
+	{
+		poll(fds, numProcs, -1);
+		for (int p = 0; p < numProcs; p++)
+		{
+			if (fds[p].fd < 0 || fds[p].revents == 0)
+				continue;
+			wall[p] = read_timer() - sent[p];
+			states[p] = aligned_alloc(CACHELINE, stateStride);
+			if (!read_full(fds[p].fd, &replies[p], sizeof(ShardReply)) || replies[p].state_bytes != stateStride ||
+				!read_full(fds[p].fd, states[p], stateStride))
+			{
+				fprintf(stderr, "Shard %d failed\n", p);
+				exit(1);
+			}
+			close(fds[p].fd);
+			fds[p].fd = -1;
+			received++;
+		}
+	}
+
+	/* combine pairs of shards at distance 1, 2, 4, ... into the lower one */
+	for (int step = 1; step < numProcs; step *= 2)
+		for (int p = 0; p + step < numProcs; p += 2 * step)
+			for (int o = 0; o < numOps; o++)
+				ops[o].combine(&ops[o], states[p] + opOffsets[o], states[p + step] + opOffsets[o]);
+	double elapsed = read_timer() - start;
+
+	for (int o = 0; o < numOps; o++)
+		ops[o].print(&ops[o], states[0] + opOffsets[o]);
+
+	int slowest = 0;
+	printf("%5s %10s %10s %12s %12s %12s\n", "shard", "first row", "rows", "init (sec)", "reduce (sec)", "wall (sec)");
+	for (int p = 0; p < numProcs; p++)
+	{
+		printf("%5d %10d %10d %12.6f %12.6f %12.6f\n", p, replies[p].first_row, replies[p].rows,
+			   replies[p].init_time, replies[p].reduce_time, wall[p]);
+		sorted[p] = wall[p];
+		if (wall[p] > wall[slowest])
+			slowest = p;
+	}
+	qsort(sorted, numProcs, sizeof(double), compare_doubles);
+	printf("The slowest shard is %d at %.2f times the median wall time\n", slowest, wall[slowest] / sorted[numProcs / 2]);
+	if (inputPath == NULL)
+		printf("The seed is %llu\n", (unsigned long long)seed);
+	printf("The execution time is %g sec\n", elapsed);
+
+	for (int p = 0; p < numProcs; p++)
+	{
+		if (waitpid(pids[p], &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+			fprintf(stderr, "Shard %d did not exit cleanly\n", p);
+		free(states[p]);
+	}
+	free(states);
+	free(pids);
+	free(fds);
+	free(replies);
+	free(sent);
+	free(wall);
+	free(sorted);
+}
+
+/* read command line, initialize, and create threads */
+int main(int argc, char *argv[])
+{
+	int i, opt;
+	const char *outputPath = NULL;
+	double init_time = 0;
+	bool bench = false, benchBarriers = false, dispatchSet = false;
+
+	seed = (uint64_t)time(NULL);
+	char defaultOps[] = "minmax";
+	parse_ops(defaultOps);
+	static struct option longOptions[] = {
+		{"dispatch", required_argument, NULL, 'm'},
+		{"chunk", required_argument, NULL, 'c'},
+		{"kernel", required_argument, NULL, 'k'},
+		{"pin", no_argument, NULL, 'p'},
+		{"seed", required_argument, NULL, 's'},
+		{"file", required_argument, NULL, 'f'},
+		{"write", required_argument, NULL, 'w'},
+		{"type", required_argument, NULL, 't'},
+		{"reduce", required_argument, NULL, 'r'},
+		{"barrier", required_argument, NULL, 'B'},
+		{"results", required_argument, NULL, 'o'},
+		{"bench", no_argument, NULL, 'b'},
+		{"bench-barriers", no_argument, NULL, 'L'},
+		{"procs", required_argument, NULL, 'P'},
+		{"socket", required_argument, NULL, 'S'},
+		{NULL, 0, NULL, 0}};
+
+	/* set global thread attributes */
+	pthread_attr_init(&attr);
+	pthread_attr_setscope(&attr, PTHREAD_SCOPE_SYSTEM);
+
+	/* initialize mutex */
+	pthread_mutex_init(&next_row_counter_mutex, NULL);
+
+	/* read options */
+	while ((opt = getopt_long(argc, argv, "m:c:k:ps:f:w:t:r:o:B:bLP:S:", longOptions, NULL)) != -1)
+	{
+		switch (opt)
+		{
+		case 'm':
+			for (i = 0; i < NUM_DISPATCH_MODES && strcmp(optarg, dispatchNames[i]) != 0; i++)
+				;
+			if (i == NUM_DISPATCH_MODES)
+			{
+				fprintf(stderr, "Unknown dispatch mode: %s\n", optarg);
+				exit(1);
+			}
+			dispatchMode = i;
+			dispatchSet = true;
+			break;
+		case 'c':
+			chunkSize = atoi(optarg);
+			if (chunkSize < 1)
+				chunkSize = 1;
+			break;
+		case 'k':
+			kernelIndex = -1;
+			for (i = 0; i < NUM_KERNELS; i++)
+				if (strcmp(optarg, kernelNames[i]) == 0)
+					kernelIndex = i;
+			if (kernelIndex < 0 && strcmp(optarg, "auto") != 0)
+			{
+				fprintf(stderr, "Unknown kernel: %s\n", optarg);
+				exit(1);
+			}
+			break;
+		case 'p':
+			pinWorkers = true;
+			break;
+		case 's':
+			seed = strtoull(optarg, NULL, 0);
+			break;
+		case 'f':
+			inputPath = optarg;
+			break;
+		case 'w':
+			outputPath = optarg;
+			break;
+		case 't':
+			for (i = 0; i < NUM_ELEM_TYPES && strcmp(optarg, elemNames[i]) != 0; i++)
+				;
+			if (i == NUM_ELEM_TYPES)
+			{
+				fprintf(stderr, "Unknown element type: %s\n", optarg);
+				exit(1);
+			}
+			elemType = i;
+			break;
+		case 'r':
+			if (!parse_ops(optarg))
+			{
+				fprintf(stderr, "Bad operator list: %s\n", optarg);
+				exit(1);
+			}
+			break;
+		case 'o':
+			resultsPath = optarg;
+			break;
+		case 'B':
+			if ((i = barrier_kind(optarg)) < 0)
+			{
+				fprintf(stderr, "Unknown barrier: %s\n", optarg);
+				exit(1);
+			}
+			barrierKind = i;
+			break;
+		case 'b':
+			bench = true;
+			break;
+		case 'L':
+			benchBarriers = true;
+			break;
+		case 'P':
+			numProcs = atoi(optarg);
+			if (numProcs < 0)
+				numProcs = 0;
+			break;
+		case 'S':
+			socketAddress = optarg;
+			break;
+		default:
+			fprintf(stderr, "usage: %s [size] [numWorkers] [-m static|mutex|chunk|guided] [-c chunk] [-k kernel] [-p] [-s seed] [-f file] [-w file] [-t type] [-r ops] [-o file] [-B barrier] [-b] [-L] [-P procs] [-S socket]\n", argv[0]);
+			exit(1);
+		}
+	}
+
+	/* pick the row kernel */
+	if (kernelIndex < 0)
+	{
+		for (kernelIndex = NUM_KERNELS - 1; !kernel_supported(kernelIndex); kernelIndex--)
+			;
+	}
+	else if (!kernel_supported(kernelIndex))
+	{
+		fprintf(stderr, "The %s kernel is not supported by this CPU\n", kernelNames[kernelIndex]);
+		exit(1);
+	}
+	row_kernel = (elemType == ELEM_INT32) ? kernels[kernelIndex] : typeKernels[elemType];
+
+	read_cpu_list();
+	if (pinWorkers && !dispatchSet)
+		dispatchMode = DISPATCH_STATIC;
+
+	/* read command line args if any */
+	size = (optind < argc) ? atoi(argv[optind]) : DEFAULTSIZE;
+	numWorkers = (optind + 1 < argc) ? atoi(argv[optind + 1]) : numCpus;
+	if (size < 1)
+		size = 1;
+	if (numWorkers < 1)
+		numWorkers = 1;
+
+	if (benchBarriers)
+	{
+		run_barrier_benchmark();
+		return 0;
+	}
+
+	/* the matrix is square unless it is read from a file */
+	rows = (inputPath != NULL) ? matrix_file_rows(inputPath) : size;
+	if (rows < 1)
+	{
+		fprintf(stderr, "Could not map %s as a matrix with %d columns\n", inputPath, size);
+		exit(1);
+	}
+
+	if (numProcs > 0)
+	{
+		/* rowsums and tiled keep their results outside the states, which are
+		   all a shard sends back */
+		for (int o = 0; o < numOps; o++)
+			if (strcmp(ops[o].name, "rowsums") == 0 || strcmp(ops[o].name, "tiled") == 0)
+			{
+				fprintf(stderr, "The %s operator cannot be used with --procs\n", ops[o].name);
+				exit(1);
+			}
+		if (bench || outputPath != NULL)
+		{
+			fprintf(stderr, "--bench and --write cannot be used with --procs\n");
+			exit(1);
+		}
+		if (numProcs > rows)
+			numProcs = rows;
+		run_coordinator();
+		return 0;
+	}
+
+	init_time = load_matrix(outputPath);
+
+	/* print the matrix */
+#ifdef DEBUG
+	for (i = 0; i < rows; i++)
+	{
+		printf("%d: [ ", i);
+		for (int j = 0; j < size; j++)
+		{
+			printf(" ");
+			print_value(stdout, element_value(matrix_row(i), j));
+		}
+		printf(" ]\n");
+	}
+#endif
+
+	if (bench)
+	{
+		run_benchmark();
+		return 0;
+	}
+
+	start_pool();
+	double elapsed = reduce_matrix();
+	for (int o = 0; o < numOps; o++)
+		ops[o].print(&ops[o], op_state(0, o));
+	stop_pool();
+	if (inputPath == NULL)
+	{
+		printf("The seed is %llu\n", (unsigned long long)seed);
+		printf("The initialization time is %g sec\n", init_time);
+	}
+	printf("The execution time is %g sec\n", elapsed);
+
+	munmap(matrixBase, matrixBytes);
+	free(rowSums);
+	free(rowStats);
+}
+
+/* Each pool worker waits for a reduction to be posted, folds the rows it
+   claims through get_next_rows into its operator states, and then takes
+   part in the tree combine of the states */
+void *Worker(void *arg)
+{
+	long myid = (long)arg;
+	int seen = 0;
+
+#ifdef DEBUG
+	printf("INIT: worker %ld (pthread id %lu) has started\n", myid, (unsigned long)pthread_self());
+#endif
+
+	pin_worker(myid);
+
+	for (;;)
+	{
+		pthread_mutex_lock(&poolLock);
+		while (poolGeneration == seen && !poolExit)
+			pthread_cond_wait(&poolStart, &poolLock);
+		seen = poolGeneration;
+		pthread_mutex_unlock(&poolLock);
+		if (poolExit)
+			break;
+
+		for (int o = 0; o < numOps; o++)
+			ops[o].init(&ops[o], op_state(myid, o));
+
+		int first_row = -1, last_row, cur_row;
+
+		while (get_next_rows(myid, &first_row, &last_row))
+		{
+#ifdef DEBUG
+			printf("TASK: worker %ld started working on rows #%d-%d\n", myid, first_row, last_row - 1);
+#endif
+			/* when streaming a file, start paging in the chunk this worker is
+			   likely to claim next while the current one is reduced */
+			if (inputPath != NULL && dispatchMode != DISPATCH_STATIC)
+				advise_rows(first_row + numWorkers * (last_row - first_row),
+							last_row + numWorkers * (last_row - first_row), MADV_WILLNEED);
+
+			for (int o = 0; o < numOps; o++)
+				if (ops[o].chunk != NULL)
+					ops[o].chunk(&ops[o], op_state(myid, o), first_row, last_row);
+
+			int released_row = first_row;
+			for (cur_row = first_row; cur_row < last_row; cur_row++)
+			{
+				if (inputPath != NULL && (size_t)(cur_row - released_row) * size * elemSizes[elemType] >= STREAMWINDOW)
+				{
+					advise_rows(released_row, cur_row, MADV_DONTNEED);
+					released_row = cur_row;
+				}
+
+				const void *row = matrix_row(cur_row);
+				for (int o = 0; o < numOps; o++)
+					if (ops[o].chunk == NULL)
+						ops[o].row(&ops[o], op_state(myid, o), row, cur_row);
+			}
+			if (inputPath != NULL)
+				advise_rows(released_row, last_row, MADV_DONTNEED);
+		}
+
+		/* combine pairs of states at distance 1, 2, 4, ... into the lower worker */
+		for (long step = 1; step < numWorkers; step *= 2)
+		{
+			barrier_wait(&poolBarrier, myid);
+			if (myid % (2 * step) == 0 && myid + step < numWorkers)
+				for (int o = 0; o < numOps; o++)
+					ops[o].combine(&ops[o], op_state(myid, o), op_state(myid + step, o));
+		}
+
+		pthread_mutex_lock(&poolLock);
+		if (++poolFinished == poolSize)
+			pthread_cond_signal(&poolDone);
+		pthread_mutex_unlock(&poolLock);
+	}
+
+	return NULL;
+}
@@ -1,28 +1,64 @@
 #ifndef _REENTRANT
 #define _REENTRANT
 #endif
+#define _GNU_SOURCE
 #include <pthread.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdbool.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
 #include <time.h>
 #include <sys/time.h>
 #include <limits.h>
 #include <unistd.h>
-#define BUFFERSIZE 1024
+#include <poll.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include "uring.h"
+#include "lz.h"
+#define BUFFERSIZE (256 << 10) // Default bytes per task, set with --block-size.
 #define BLOCKSIZE 100
+#define LAG 64                // Default for how many blocks a sink may fall behind the reader, set with --lag.
+#define CACHELINE 64
+#define SPINS 1024            // Polls of a cursor before a waiting thread sleeps on its futex.
+#define SPLICECHUNK (1 << 20) // Most bytes teed per tee(2) call.
+#define SPLICECOPY 65536      // Buffer for sinks that do not support splice(2).
+#define MEMORYCAP (64 << 20)  // Default cap on buffered bytes, set with --memory.
+#define DIRECTALIGN 4096      // Alignment of every buffer, and of the block size with --direct.
+#define FRAMEHEADER 8         // Bytes in front of every compressed block: its raw and its stored length.
+#define FRAMEMAGIC "TLZ1"     // The first bytes of every compressed file.
+#define LATENCYBUCKETS 32     // Buckets of the latency histogram, bucket b counts latencies below 2^(b + 1) microseconds.
+#define BENCHMB 256           // Default amount of input generated by --bench, in units of BENCHCHUNK.
+#define BENCHCHUNK 1000000    // Bytes of lines the benchmark input repeats.
+#define BENCHSINKS 16         // Most sinks in the fan-out benchmark.
+#define BENCHLINE 80          // Length of the generated lines, including the newline.
 
 // Function prototypes.
 void *read_worker();
-void *stdout_worker();
-void *write_worker();
+void *sink_worker(void *arg);
+void *ring_read_worker();
+void *ring_sink_worker(void *arg);
+void *uring_writer(void *arg);
+void *compress_worker(void *arg);
+void *stats_worker();
 
-/// @brief A task containing a buffer, a mutex to lock the buffer, and a flag to indicate if the task has been partially processed.
+/// @brief A task containing a buffer and the number of bytes in it, a mutex to lock the buffer, and the number of sinks that have
+/// processed the task.
 typedef struct Task
 {
-    char Buffer[BUFFERSIZE];
+    char *Buffer;
+    size_t length;
     pthread_mutex_t mutex;
-    bool is_partially_processed;
+    int processed;
+    unsigned long long read_at; // When the reader got the block, for the latency statistics.
 } Task;
 
 /// @brief A block of tasks, also containing a pointer to the next block, and a pointer to the last task in the block.
@@ -33,10 +69,1200 @@ typedef struct TaskBlock
     struct TaskBlock *next_block;
 } TaskBlock;
 
+/// @brief One block of input, stored in a slot of the ring, and its compressed frame when files are compressed. The last sink to write
+/// it returns the buffers to their pools.
+typedef struct Slot
+{
+    char *Buffer;
+    size_t length;
+    char *Compressed;
+    size_t compressed_length;
+    unsigned long long read_at; // When the reader got the block, for the latency statistics.
+    atomic_int references;
+} Slot;
+
+/// @brief A pool of equally sized objects. Released objects are kept on a free list and handed out again, and at most capacity
+/// objects are ever allocated, so a pool that is used up makes the next caller of pool_get wait for a release.
+typedef struct Pool
+{
+    size_t object_size;
+    size_t capacity; // 0 for no limit.
+    size_t allocated;
+    size_t in_use;
+    size_t peak_in_use;
+    void *free_list; // Each free object starts with the pointer to the next one.
+    pthread_mutex_t mutex;
+    pthread_cond_t released;
+} Pool;
+
+/// @brief A position in the ring, kept on its own cache line so the reader and every sink write to different lines.
+typedef struct Cursor
+{
+    _Alignas(CACHELINE) atomic_uint position;
+    atomic_int sleepers;
+    atomic_bool closed; // Set once the cursor will not move again.
+} Cursor;
+
+/// @brief A bounded single-producer/multi-consumer ring. The reader publishes block number n in slot n % size by advancing head, and
+/// every sink advances its own tail once it has written the block, so every sink sees every byte in order. The reader only runs lag
+/// blocks ahead of the slowest tail, so a slow sink holds back the others only once it is that far behind. Both sides only touch
+/// atomics and sleep on the futex of the cursor they wait for.
+typedef struct Ring
+{
+    Slot *slots;
+    unsigned size; // A power of two, at least lag.
+    unsigned lag;
+    Cursor head;
+    Cursor *tails;       // One per sink.
+    Cursor *compressors; // One per compression thread, at the next block it compresses.
+} Ring;
+
+/// @brief An output of the tee: its file descriptor, whether the fsync policy applies to it, whether it is written with O_DIRECT, and
+/// whether it gets the compressed frames instead of the input.
+typedef struct Sink
+{
+    int descriptor;
+    bool regular;  // A regular file, the only kind of sink that is synced.
+    bool direct;   // Opened with O_DIRECT, which is dropped again for a last block that is not aligned.
+    bool compress; // Written with the compressed frames.
+    long unsynced; // Blocks written since the last fdatasync.
+} Sink;
+
+/// @brief The state of one sink in the io_uring writer, which keeps at most one operation per sink in flight so its writes stay ordered.
+typedef struct UringSink
+{
+    unsigned tail;  // Next block of the ring to write.
+    size_t written; // Bytes of that block already written.
+    enum
+    {
+        OP_NONE,
+        OP_WRITE,
+        OP_SYNC,
+        OP_FINAL_SYNC
+    } op;           // The operation in flight.
+    bool sync_due;  // An fdatasync has to follow the last write.
+    bool synced;    // The final fsync is done.
+    bool finished;
+} UringSink;
+
+/// @brief The counters of one stage of the pipeline: the reader, a sink or a compression thread. Only the thread running the stage
+/// updates them, the reporter reads them while it runs, so plain loads and stores of the atomics suffice. The uring writer counts for
+/// every sink it writes.
+typedef struct Stats
+{
+    _Alignas(CACHELINE) atomic_ullong blocks;
+    atomic_ullong bytes_in;
+    atomic_ullong bytes_out;
+    atomic_ullong blocked;     // Nanoseconds spent waiting for another stage.
+    atomic_ullong max_latency; // Nanoseconds from read to write of the slowest block.
+    atomic_ullong latency[LATENCYBUCKETS];
+} Stats;
+
+/// @brief How blocks are handed from the reader to the sinks.
+typedef enum
+{
+    QUEUE_RING,  // The lock-free ring.
+    QUEUE_MUTEX, // A list of task blocks with one mutex per task.
+    NUM_QUEUES
+} QueueKind;
+
+const char *queue_names[NUM_QUEUES] = {"ring", "mutex"};
+
+/// @brief How the sinks are written.
+typedef enum
+{
+    WRITER_THREADS, // One thread per sink, blocking in write(2).
+    WRITER_URING,   // One thread submitting the writes of all sinks to io_uring, needs the ring.
+    NUM_WRITERS
+} WriterKind;
+
+const char *writer_names[NUM_WRITERS] = {"threads", "uring"};
+
 // Global variables.
 TaskBlock *initial_block;
 bool finished_reading = false;
-FILE *file_pointer;
+int input_descriptor;
+int num_sinks;
+Sink *sinks; // stdout followed by the files.
+WriterKind writer = WRITER_THREADS;
+bool direct_io = false;  // Open the files with O_DIRECT.
+long fsync_every = 0;    // Blocks between fdatasync calls on every file, 0 for none.
+bool fsync_at_end = false;
+size_t block_size = BUFFERSIZE;
+size_t memory_cap = MEMORYCAP;
+size_t peak_memory; // Peak bytes held by the pools in the last run.
+Pool buffer_pool;   // Buffers of block_size bytes.
+Pool frame_pool;    // Buffers for the compressed frame of a block.
+Pool task_block_pool;
+bool compress = false;          // Compress the files.
+int compress_threads;           // Threads compressing blocks, by default one per CPU.
+atomic_size_t compressed_input; // Bytes compressed in the last run.
+atomic_size_t compressed_bytes; // Bytes of compressed frames produced from them.
+bool stats_enabled = false;      // Count with --stats.
+double stats_interval = 0;       // Seconds between the lines of the reporter, 0 for none.
+Stats reader_stats;
+Stats *sink_stats;               // One per sink.
+Stats *compress_stats;           // One per compression thread.
+int num_compress_stats;          // Compression threads of the current run.
+atomic_bool stats_done;          // Tells the reporter to stop.
+unsigned long long stats_start;  // When the current run began.
+Ring ring;
+unsigned lag = LAG;
+int spins; // SPINS, or 0 on a single CPU where spinning only delays the thread being waited for.
+
+/// @brief Returns the wall clock time in seconds.
+double read_timer()
+{
+    struct timeval time;
+    gettimeofday(&time, NULL);
+    return time.tv_sec + time.tv_usec * 1e-6;
+}
+
+/// @brief Returns the monotonic time for the statistics.
+/// @return The time in nanoseconds, or 0 when the statistics are off so callers pay nothing for it.
+unsigned long long stats_clock()
+{
+    struct timespec now;
+
+    if (!stats_enabled)
+    {
+        return 0;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+/// @brief Adds to a counter that only the calling thread updates.
+/// @param counter The counter.
+/// @param amount The amount to add.
+void stats_add(atomic_ullong *counter, unsigned long long amount)
+{
+    atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) + amount, memory_order_relaxed);
+}
+
+/// @brief Counts the time a stage waited for another one.
+/// @param stats The counters of the stage.
+/// @param since The time from stats_clock when the wait began.
+void stats_blocked(Stats *stats, unsigned long long since)
+{
+    if (stats_enabled)
+    {
+        stats_add(&stats->blocked, stats_clock() - since);
+    }
+}
+
+/// @brief Counts a block that went through a stage.
+/// @param stats The counters of the stage.
+/// @param bytes_in The bytes the stage took in.
+/// @param bytes_out The bytes the stage put out.
+void stats_block(Stats *stats, size_t bytes_in, size_t bytes_out)
+{
+    if (stats_enabled)
+    {
+        stats_add(&stats->blocks, 1);
+        stats_add(&stats->bytes_in, bytes_in);
+        stats_add(&stats->bytes_out, bytes_out);
+    }
+}
+
+/// @brief Counts the time from read to write of a block in the latency histogram of a sink.
+/// @param stats The counters of the sink.
+/// @param read_at The time from stats_clock when the block was read.
+void stats_latency(Stats *stats, unsigned long long read_at)
+{
+    if (!stats_enabled)
+    {
+        return;
+    }
+
+    unsigned long long latency = stats_clock() - read_at, micros = latency / 1000;
+    int bucket = 0;
+    while (micros > 1 && bucket < LATENCYBUCKETS - 1)
+    {
+        micros >>= 1;
+        bucket++;
+    }
+    stats_add(&stats->latency[bucket], 1);
+    if (latency > atomic_load_explicit(&stats->max_latency, memory_order_relaxed))
+    {
+        atomic_store_explicit(&stats->max_latency, latency, memory_order_relaxed);
+    }
+}
+
+/// @brief Initializes an empty pool.
+/// @param pool The pool.
+/// @param object_size The size of the objects, at least the size of a pointer.
+/// @param capacity The most objects to allocate, 0 for no limit.
+void pool_init(Pool *pool, size_t object_size, size_t capacity)
+{
+    pool->object_size = object_size;
+    pool->capacity = capacity;
+    pool->allocated = pool->in_use = pool->peak_in_use = 0;
+    pool->free_list = NULL;
+    pthread_mutex_init(&pool->mutex, NULL);
+    pthread_cond_init(&pool->released, NULL);
+}
+
+/// @brief Takes an object from the pool, allocating one while below capacity and waiting for a release otherwise.
+/// @param pool The pool.
+/// @return The object.
+void *pool_get(Pool *pool)
+{
+    void *object;
+
+    pthread_mutex_lock(&pool->mutex);
+    while (pool->free_list == NULL && pool->capacity > 0 && pool->allocated == pool->capacity)
+    {
+        pthread_cond_wait(&pool->released, &pool->mutex);
+    }
+    if (pool->free_list != NULL)
+    {
+        object = pool->free_list;
+        pool->free_list = *(void **)object;
+    }
+    else
+    {
+        object = aligned_alloc(DIRECTALIGN, (pool->object_size + DIRECTALIGN - 1) & ~(size_t)(DIRECTALIGN - 1));
+        if (object == NULL)
+        {
+            fprintf(stderr, "Out of memory.\n");
+            exit(1);
+        }
+        pool->allocated++;
+    }
+    if (++pool->in_use > pool->peak_in_use)
+    {
+        pool->peak_in_use = pool->in_use;
+    }
+    pthread_mutex_unlock(&pool->mutex);
+    return object;
+}
+
+/// @brief Returns an object to the pool.
+/// @param pool The pool.
+/// @param object The object.
+void pool_put(Pool *pool, void *object)
+{
+    pthread_mutex_lock(&pool->mutex);
+    *(void **)object = pool->free_list;
+    pool->free_list = object;
+    pool->in_use--;
+    pthread_cond_signal(&pool->released);
+    pthread_mutex_unlock(&pool->mutex);
+}
+
+/// @brief Frees the objects on the free list of a pool.
+/// @param pool The pool.
+void pool_destroy(Pool *pool)
+{
+    while (pool->free_list != NULL)
+    {
+        void *next = *(void **)pool->free_list;
+        free(pool->free_list);
+        pool->free_list = next;
+    }
+    pthread_mutex_destroy(&pool->mutex);
+    pthread_cond_destroy(&pool->released);
+}
+
+/// @brief Fills a buffer with read(2). Waits until some input arrives and then keeps reading for as long as more is available without
+/// blocking, so a fast producer fills whole buffers while input that trickles in is passed on at once. With --direct the buffer is
+/// always filled, since O_DIRECT only takes whole aligned blocks.
+/// @param in The file descriptor to read.
+/// @param buffer The buffer to fill.
+/// @param size The size of the buffer.
+/// @return The number of bytes read, 0 at the end of the input.
+size_t read_block(int in, char *buffer, size_t size)
+{
+    size_t length = 0;
+
+    while (length < size)
+    {
+        struct pollfd ready = {in, POLLIN, 0};
+        if (length > 0 && !direct_io && poll(&ready, 1, 0) < 1)
+        {
+            break;
+        }
+
+        ssize_t got = read(in, buffer + length, size - length);
+        if (got < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (got < 0)
+        {
+            fprintf(stderr, "Could not read input.\n");
+        }
+        if (got <= 0)
+        {
+            break;
+        }
+        length += got;
+    }
+    return length;
+}
+
+/// @brief Reads until a buffer is full or the input ends.
+/// @param in The file descriptor to read.
+/// @param buffer The buffer to fill.
+/// @param size The number of bytes to read.
+/// @return The number of bytes read, less than size only at the end of the input.
+size_t read_full(int in, char *buffer, size_t size)
+{
+    size_t length = 0;
+
+    while (length < size)
+    {
+        ssize_t got = read(in, buffer + length, size - length);
+        if (got < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (got <= 0)
+        {
+            break;
+        }
+        length += got;
+    }
+    return length;
+}
+
+/// @brief Writes a whole buffer with write(2), and exits if the sink fails.
+/// @param out The file descriptor to write.
+/// @param buffer The bytes to write.
+/// @param length The number of bytes.
+void write_block(int out, const char *buffer, size_t length)
+{
+    while (length > 0)
+    {
+        ssize_t written = write(out, buffer, length);
+        if (written < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (written <= 0)
+        {
+            fprintf(stderr, "Could not write output.\n");
+            exit(1);
+        }
+        buffer += written;
+        length -= written;
+    }
+}
+
+/// @brief Turns O_DIRECT off for a sink, before writing a block that is not a multiple of DIRECTALIGN.
+/// @param sink The sink.
+void sink_drop_direct(Sink *sink)
+{
+    fcntl(sink->descriptor, F_SETFL, fcntl(sink->descriptor, F_GETFL) & ~O_DIRECT);
+    sink->direct = false;
+}
+
+/// @brief Whether a sink is due for an fdatasync after one more block has been written to it.
+/// @param sink The sink.
+/// @return True if the fsync policy asks for an fdatasync now.
+bool sink_block_written(Sink *sink)
+{
+    if (fsync_every == 0 || !sink->regular || ++sink->unsynced < fsync_every)
+    {
+        return false;
+    }
+    sink->unsynced = 0;
+    return true;
+}
+
+/// @brief Writes a block to a sink and applies the fsync policy.
+/// @param sink The sink.
+/// @param buffer The bytes to write.
+/// @param length The number of bytes.
+void sink_write(Sink *sink, const char *buffer, size_t length)
+{
+    if (sink->direct && length % DIRECTALIGN != 0)
+    {
+        sink_drop_direct(sink);
+    }
+    write_block(sink->descriptor, buffer, length);
+    if (sink_block_written(sink) && fdatasync(sink->descriptor) != 0)
+    {
+        fprintf(stderr, "Could not sync output.\n");
+        exit(1);
+    }
+}
+
+/// @brief Whether the fsync policy wants a sink synced once the input has ended.
+/// @param sink The sink.
+/// @return True if the sink needs a final fsync.
+bool sink_needs_final_sync(Sink *sink)
+{
+    return sink->regular && (fsync_every > 0 || fsync_at_end);
+}
+
+/// @brief Finishes a sink once the input has ended, syncing it if the fsync policy asks for it.
+/// @param sink The sink.
+void sink_finish(Sink *sink)
+{
+    if (sink_needs_final_sync(sink) && fsync(sink->descriptor) != 0)
+    {
+        fprintf(stderr, "Could not sync output.\n");
+        exit(1);
+    }
+}
+
+/// @brief Waits until a cursor no longer holds the given position or is closed: spins for a while, then sleeps on the futex of the cursor.
+/// @param cursor The cursor to wait on.
+/// @param position The position the caller has already seen.
+void cursor_wait(Cursor *cursor, unsigned position)
+{
+    for (int spin = 0; spin < spins; spin++)
+    {
+        if (atomic_load_explicit(&cursor->position, memory_order_acquire) != position || atomic_load(&cursor->closed))
+        {
+            return;
+        }
+    }
+
+    // Both sides use sequentially consistent accesses, so either the mover sees the sleeper or the sleeper sees the move.
+    atomic_fetch_add(&cursor->sleepers, 1);
+    while (atomic_load(&cursor->position) == position && !atomic_load(&cursor->closed))
+    {
+        syscall(SYS_futex, &cursor->position, FUTEX_WAIT_PRIVATE, position, NULL, NULL, 0);
+    }
+    atomic_fetch_sub(&cursor->sleepers, 1);
+}
+
+/// @brief Wakes whoever sleeps on a cursor.
+/// @param cursor The cursor that moved.
+void cursor_wake(Cursor *cursor)
+{
+    if (atomic_load(&cursor->sleepers) > 0)
+    {
+        syscall(SYS_futex, &cursor->position, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+    }
+}
+
+/// @brief Moves a cursor to a new position and wakes whoever sleeps on it.
+/// @param cursor The cursor to move.
+/// @param position The new position.
+void cursor_move(Cursor *cursor, unsigned position)
+{
+    atomic_store(&cursor->position, position);
+    cursor_wake(cursor);
+}
+
+/// @brief Closes a cursor and wakes whoever sleeps on it.
+/// @param cursor The cursor to close.
+void cursor_close(Cursor *cursor)
+{
+    atomic_store(&cursor->closed, true);
+    cursor_wake(cursor);
+}
+
+/// @brief Releases one reference to a block of the ring, the last one returns its buffers to the pools.
+/// @param slot The slot of the block.
+void slot_release(Slot *slot)
+{
+    if (atomic_fetch_sub(&slot->references, 1) == 1)
+    {
+        pool_put(&buffer_pool, slot->Buffer);
+        if (slot->Compressed != NULL)
+        {
+            pool_put(&frame_pool, slot->Compressed);
+        }
+    }
+}
+
+/// @brief Whether a block of the ring has been compressed. Compression thread i compresses the blocks i, i + compress_threads, and so on,
+/// and its cursor holds the next of them it will compress.
+/// @param block The number of the block.
+/// @param cursor Set to the cursor of the thread that compresses the block.
+/// @param position Set to the position of that cursor.
+/// @return True if the compressed frame of the block is ready.
+bool block_compressed(unsigned block, Cursor **cursor, unsigned *position)
+{
+    *cursor = &ring.compressors[block % compress_threads];
+    *position = atomic_load_explicit(&(*cursor)->position, memory_order_acquire);
+    return (int)(*position - block) > 0;
+}
+
+/// @brief Returns the bytes of a block a sink writes: the compressed frame for a compressed sink, once it is ready, and the input itself
+/// otherwise.
+/// @param slot The slot of the block.
+/// @param block The number of the block.
+/// @param sink The sink.
+/// @param length Set to the number of bytes.
+/// @return The bytes to write.
+const char *slot_data(Slot *slot, unsigned block, Sink *sink, size_t *length)
+{
+    Cursor *cursor;
+    unsigned position;
+
+    if (!sink->compress)
+    {
+        *length = slot->length;
+        return slot->Buffer;
+    }
+    while (!block_compressed(block, &cursor, &position))
+    {
+        cursor_wait(cursor, position);
+    }
+    *length = slot->compressed_length;
+    return slot->Compressed;
+}
+
+/// @brief Stores a 32-bit number in little endian byte order, as in the frame headers.
+/// @param bytes Where to store the number.
+/// @param value The number.
+void frame_put32(char *bytes, uint32_t value)
+{
+    for (int i = 0; i < 4; i++)
+    {
+        bytes[i] = (char)(value >> (8 * i));
+    }
+}
+
+/// @brief Reads a 32-bit number in little endian byte order.
+/// @param bytes Where the number is stored.
+/// @return The number.
+uint32_t frame_get32(const char *bytes)
+{
+    uint32_t value = 0;
+    for (int i = 0; i < 4; i++)
+    {
+        value |= (uint32_t)(unsigned char)bytes[i] << (8 * i);
+    }
+    return value;
+}
+
+/// @brief Reads the counters of a stage, the compression threads count as one stage.
+/// @param stage 0 for the reader, 1 for the compression threads, 2 + i for sink i.
+/// @param blocks Set to the number of blocks.
+/// @param bytes Set to the bytes read by the reader and the compression threads, and to the bytes written by a sink.
+/// @param blocked Set to the nanoseconds spent waiting.
+void stats_stage(int stage, unsigned long long *blocks, unsigned long long *bytes, unsigned long long *blocked)
+{
+    Stats *group = (stage == 0) ? &reader_stats : (stage == 1) ? compress_stats : &sink_stats[stage - 2];
+    int count = (stage == 1) ? num_compress_stats : 1;
+
+    *blocks = *bytes = *blocked = 0;
+    for (int i = 0; i < count; i++)
+    {
+        *blocks += atomic_load_explicit(&group[i].blocks, memory_order_relaxed);
+        *bytes += atomic_load_explicit(stage < 2 ? &group[i].bytes_in : &group[i].bytes_out, memory_order_relaxed);
+        *blocked += atomic_load_explicit(&group[i].blocked, memory_order_relaxed);
+    }
+}
+
+/// @brief Returns how many blocks a sink is behind the reader.
+/// @param sink The index of the sink.
+/// @return The number of blocks read but not yet written to the sink.
+unsigned long long stats_lag(int sink)
+{
+    // Load the sink first, the reader counts a block before any sink can.
+    unsigned long long written = atomic_load(&sink_stats[sink].blocks), read = atomic_load(&reader_stats.blocks);
+    return (read > written) ? read - written : 0;
+}
+
+/// @brief Estimates a percentile of the latencies of a sink from its histogram.
+/// @param stats The counters of the sink.
+/// @param fraction The percentile as a fraction, like 0.99.
+/// @return The upper bound in microseconds of the bucket holding the percentile, clamped to the largest latency seen so it never reports
+/// more than the max, 0 before the first block.
+unsigned long long stats_percentile(Stats *stats, double fraction)
+{
+    unsigned long long total = 0, seen = 0;
+
+    for (int b = 0; b < LATENCYBUCKETS; b++)
+    {
+        total += atomic_load_explicit(&stats->latency[b], memory_order_relaxed);
+    }
+    for (int b = 0; b < LATENCYBUCKETS && total > 0; b++)
+    {
+        seen += atomic_load_explicit(&stats->latency[b], memory_order_relaxed);
+        if (seen >= fraction * total)
+        {
+            unsigned long long max = atomic_load_explicit(&stats->max_latency, memory_order_relaxed) / 1000;
+            return ((2ULL << b) < max) ? (2ULL << b) : max;
+        }
+    }
+    return 0;
+}
+
+/// @brief Prints all counters to stderr as one line of JSON.
+void stats_print_json()
+{
+    unsigned long long blocks, bytes, blocked;
+
+    flockfile(stderr);
+    stats_stage(0, &blocks, &bytes, &blocked);
+    fprintf(stderr, "{\"elapsed_s\": %.3f, \"reader\": {\"blocks\": %llu, \"bytes\": %llu, \"blocked_s\": %.3f}, \"compressors\": [",
+            (stats_clock() - stats_start) / 1e9, blocks, bytes, blocked / 1e9);
+    for (int i = 0; i < num_compress_stats; i++)
+    {
+        Stats *stats = &compress_stats[i];
+        fprintf(stderr, "%s{\"blocks\": %llu, \"bytes_in\": %llu, \"bytes_out\": %llu, \"blocked_s\": %.3f}", (i > 0) ? ", " : "",
+                atomic_load(&stats->blocks), atomic_load(&stats->bytes_in), atomic_load(&stats->bytes_out), atomic_load(&stats->blocked) / 1e9);
+    }
+    fprintf(stderr, "], \"sinks\": [");
+    for (int i = 0; i < num_sinks; i++)
+    {
+        Stats *stats = &sink_stats[i];
+        fprintf(stderr,
+                "%s{\"blocks\": %llu, \"bytes_in\": %llu, \"bytes_out\": %llu, \"lag\": %llu, \"blocked_s\": %.3f, "
+                "\"latency_us\": {\"p50\": %llu, \"p99\": %llu, \"max\": %llu, \"buckets\": [",
+                (i > 0) ? ", " : "", atomic_load(&stats->blocks), atomic_load(&stats->bytes_in), atomic_load(&stats->bytes_out), stats_lag(i),
+                atomic_load(&stats->blocked) / 1e9, stats_percentile(stats, 0.5), stats_percentile(stats, 0.99),
+                atomic_load(&stats->max_latency) / 1000);
+        for (int b = 0; b < LATENCYBUCKETS; b++)
+        {
+            fprintf(stderr, "%s%llu", (b > 0) ? ", " : "", atomic_load(&stats->latency[b]));
+        }
+        fprintf(stderr, "]}}");
+    }
+    fprintf(stderr, "]}\n");
+    funlockfile(stderr);
+}
+
+/// @brief Prints one line to stderr with the throughput and the share of time spent blocked of every stage since the last line, and
+/// the lag and the 99th percentile latency of every sink.
+/// @param last The blocks, bytes and blocked time of every stage at the last line, updated here.
+/// @param seconds The seconds since the last line.
+void stats_print_line(unsigned long long *last, double seconds)
+{
+    flockfile(stderr);
+    fprintf(stderr, "stats %7.1fs:", (stats_clock() - stats_start) / 1e9);
+    for (int stage = 0; stage < 2 + num_sinks; stage++)
+    {
+        unsigned long long blocks, bytes, blocked, *previous = &last[3 * stage];
+        int threads = (stage == 1) ? num_compress_stats : 1;
+
+        if (threads == 0)
+        {
+            continue;
+        }
+        stats_stage(stage, &blocks, &bytes, &blocked);
+        if (stage < 2)
+        {
+            fprintf(stderr, " %s", (stage == 0) ? "read" : "| lz");
+        }
+        else
+        {
+            fprintf(stderr, " | %d:", stage - 2);
+        }
+        // A wait is counted when it ends, so one that spans several lines all goes to the last of them.
+        double share = 100 * (blocked - previous[2]) / 1e9 / seconds / threads;
+        fprintf(stderr, " %.1f MB/s, blocked %.0f%%", (bytes - previous[1]) / seconds / 1e6, (share < 100) ? share : 100);
+        if (stage >= 2)
+        {
+            fprintf(stderr, ", lag %llu, p99 %llu us", stats_lag(stage - 2), stats_percentile(&sink_stats[stage - 2], 0.99));
+        }
+        previous[0] = blocks;
+        previous[1] = bytes;
+        previous[2] = blocked;
+    }
+    fprintf(stderr, "\n");
+    funlockfile(stderr);
+}
+
+/// @brief This function reports the statistics while the tee runs: a line every stats_interval seconds, and the JSON dump whenever the
+/// process gets SIGUSR1. Every other thread blocks SIGUSR1, so the signal is taken here with sigtimedwait and printing stays out of
+/// signal handlers.
+void *stats_worker()
+{
+    sigset_t signals;
+    unsigned long long *last = (unsigned long long *)calloc(3 * (2 + num_sinks), sizeof(unsigned long long));
+    unsigned long long last_time = stats_start;
+
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGUSR1);
+    for (;;)
+    {
+        double wait = (stats_interval > 0) ? stats_interval : 3600;
+        struct timespec timeout = {(time_t)wait, (long)((wait - (time_t)wait) * 1e9)};
+        int received = sigtimedwait(&signals, NULL, &timeout);
+
+        // run_tee wakes the reporter with SIGUSR1 once the pipeline is done.
+        if (atomic_load(&stats_done))
+        {
+            break;
+        }
+        if (received == SIGUSR1)
+        {
+            stats_print_json();
+        }
+        else if (received < 0 && errno == EAGAIN && stats_interval > 0)
+        {
+            unsigned long long now = stats_clock();
+            stats_print_line(last, (now - last_time) / 1e9);
+            last_time = now;
+        }
+    }
+
+    free(last);
+    return NULL;
+}
+
+/// @brief Runs the reader and the writer of the sinks over the chosen queue until the input ends.
+/// @param queue The queue to hand the blocks over with.
+void run_tee(QueueKind queue)
+{
+    // Create thread variables.
+    pthread_attr_t attr;
+    pthread_t read_thread, stats_thread, *sink_threads = (pthread_t *)malloc(num_sinks * sizeof(pthread_t)), *compress_thread_ids = NULL;
+    int num_threads = num_sinks, num_compressors = 0;
+    Uring uring;
+
+    // Set the thread attributes.
+    pthread_attr_init(&attr);
+    pthread_attr_setscope(&attr, PTHREAD_SCOPE_SYSTEM);
+
+    // The buffers are capped so a stalled sink makes the reader wait instead of buffering the input without bound.
+    pool_init(&buffer_pool, block_size, (memory_cap / block_size > 0) ? memory_cap / block_size : 1);
+    pool_init(&frame_pool, FRAMEHEADER + lz_bound(block_size), buffer_pool.capacity);
+    pool_init(&task_block_pool, sizeof(TaskBlock), 0);
+    atomic_store(&compressed_input, 0);
+    atomic_store(&compressed_bytes, 0);
+
+    // The counters are always there so the stages need no checks for them, they only count with --stats.
+    memset(&reader_stats, 0, sizeof(Stats));
+    sink_stats = (Stats *)aligned_alloc(CACHELINE, num_sinks * sizeof(Stats));
+    compress_stats = (Stats *)aligned_alloc(CACHELINE, compress_threads * sizeof(Stats));
+    memset(sink_stats, 0, num_sinks * sizeof(Stats));
+    memset(compress_stats, 0, compress_threads * sizeof(Stats));
+    num_compress_stats = 0;
+    stats_start = stats_clock();
+
+    if (queue == QUEUE_RING)
+    {
+        // Start with an empty ring.
+        ring.lag = lag;
+        for (ring.size = 1; ring.size < ring.lag; ring.size *= 2)
+            ;
+        ring.slots = (Slot *)malloc(ring.size * sizeof(Slot));
+        ring.tails = (Cursor *)aligned_alloc(CACHELINE, num_sinks * sizeof(Cursor));
+        atomic_init(&ring.head.position, 0);
+        atomic_init(&ring.head.sleepers, 0);
+        atomic_init(&ring.head.closed, false);
+        for (int i = 0; i < num_sinks; i++)
+        {
+            atomic_init(&ring.tails[i].position, 0);
+            atomic_init(&ring.tails[i].sleepers, 0);
+            atomic_init(&ring.tails[i].closed, false);
+            if (sinks[i].compress)
+            {
+                num_compressors = compress_threads;
+            }
+        }
+
+        // A frame is never held without its block, so the frame pool never runs out before the buffer pool does.
+        ring.compressors = (Cursor *)aligned_alloc(CACHELINE, (num_compressors > 0 ? num_compressors : 1) * sizeof(Cursor));
+        compress_thread_ids = (pthread_t *)malloc((num_compressors > 0 ? num_compressors : 1) * sizeof(pthread_t));
+        for (int i = 0; i < num_compressors; i++)
+        {
+            atomic_init(&ring.compressors[i].position, i);
+            atomic_init(&ring.compressors[i].sleepers, 0);
+            atomic_init(&ring.compressors[i].closed, false);
+        }
+
+        // One operation per sink is in flight at a time, so the submission queue never fills up.
+        unsigned entries = 8;
+        while (entries < (unsigned)num_sinks)
+        {
+            entries *= 2;
+        }
+        if (writer == WRITER_URING && !uring_init(&uring, entries))
+        {
+            fprintf(stderr, "io_uring is not available (%s), writing with one thread per sink.\n", strerror(errno));
+            writer = WRITER_THREADS;
+        }
+
+        // Create the threads.
+        pthread_create(&read_thread, &attr, ring_read_worker, NULL);
+        for (long i = 0; i < num_compressors; i++)
+        {
+            pthread_create(&compress_thread_ids[i], &attr, compress_worker, (void *)i);
+        }
+        if (writer == WRITER_URING)
+        {
+            pthread_create(&sink_threads[0], &attr, uring_writer, &uring);
+            num_threads = 1;
+        }
+        else
+        {
+            for (long i = 0; i < num_sinks; i++)
+            {
+                pthread_create(&sink_threads[i], &attr, ring_sink_worker, (void *)i);
+            }
+        }
+    }
+    else
+    {
+        // Create the initial block.
+        finished_reading = false;
+        initial_block = (TaskBlock *)pool_get(&task_block_pool);
+        initial_block->next_block = NULL;
+        initial_block->tail = &initial_block->tasks[0];
+
+        // Init the first task's mutex and lock it so the read thread can start reading.
+        pthread_mutex_init(&initial_block->tail->mutex, NULL);
+        pthread_mutex_lock(&initial_block->tail->mutex);
+
+        // Create the threads.
+        pthread_create(&read_thread, &attr, read_worker, NULL);
+        for (long i = 0; i < num_sinks; i++)
+        {
+            pthread_create(&sink_threads[i], &attr, sink_worker, (void *)i);
+        }
+    }
+
+    num_compress_stats = num_compressors;
+    if (stats_enabled)
+    {
+        atomic_store(&stats_done, false);
+        pthread_create(&stats_thread, &attr, stats_worker, NULL);
+    }
+
+    // Wait for the threads to finish.
+    pthread_join(read_thread, NULL);
+    for (int i = 0; i < num_threads; i++)
+    {
+        pthread_join(sink_threads[i], NULL);
+    }
+    for (int i = 0; i < num_compressors; i++)
+    {
+        pthread_join(compress_thread_ids[i], NULL);
+    }
+    free(sink_threads);
+
+    if (queue == QUEUE_RING)
+    {
+        if (writer == WRITER_URING)
+        {
+            uring_destroy(&uring);
+        }
+        free(ring.slots);
+        free(ring.tails);
+        free(ring.compressors);
+        free(compress_thread_ids);
+    }
+
+    // Stop the reporter and print the final counters.
+    if (stats_enabled)
+    {
+        atomic_store(&stats_done, true);
+        pthread_kill(stats_thread, SIGUSR1);
+        pthread_join(stats_thread, NULL);
+        stats_print_json();
+    }
+    free(sink_stats);
+    free(compress_stats);
+
+    peak_memory = buffer_pool.peak_in_use * buffer_pool.object_size + frame_pool.peak_in_use * frame_pool.object_size +
+                  task_block_pool.peak_in_use * task_block_pool.object_size;
+    pool_destroy(&buffer_pool);
+    pool_destroy(&frame_pool);
+    pool_destroy(&task_block_pool);
+}
+
+/// @brief Moves exactly length bytes from a pipe to a sink with splice(2). A sink that does not support splice gets the bytes through
+/// read(2) and write(2) instead, which the caller learns through unsupported.
+/// @param from The pipe to move the bytes out of.
+/// @param to The sink.
+/// @param length The number of bytes, all of which are already in the pipe.
+/// @param unsupported Set when the sink does not support splice.
+/// @return False if the bytes could not be moved.
+bool splice_all(int from, int to, size_t length, bool *unsupported)
+{
+    char buffer[SPLICECOPY];
+
+    while (length > 0 && !*unsupported)
+    {
+        ssize_t moved = splice(from, NULL, to, NULL, length, SPLICE_F_MOVE);
+        if (moved < 0 && errno == EINVAL)
+        {
+            *unsupported = true;
+        }
+        else if (moved < 0 && errno != EINTR)
+        {
+            return false;
+        }
+        else if (moved > 0)
+        {
+            length -= moved;
+        }
+    }
+
+    while (length > 0)
+    {
+        ssize_t got = read(from, buffer, length < sizeof(buffer) ? length : sizeof(buffer));
+        if (got <= 0 || write(to, buffer, got) != got)
+        {
+            return false;
+        }
+        length -= got;
+    }
+    return true;
+}
+
+/// @brief Tees the input to stdout and a single file without copying it into user space: tee(2) duplicates the pipe contents into stdout,
+/// through a staging pipe when stdout is not a pipe itself, and splice(2) then moves the same bytes from the input into the file.
+/// @param in The input file descriptor.
+/// @return True when the whole input has been teed, false when the file descriptors do not allow it and the threaded path has to take
+/// over, either from the start or after the last complete chunk.
+bool splice_tee(int in)
+{
+    int out = sinks[0].descriptor, file = sinks[1].descriptor;
+    int stage[2] = {-1, -1};
+    bool unsupported = false;
+    struct stat st;
+
+    // Only a pipe can be the source of tee(2), and every further tee of the same pipe could duplicate a different amount, so this
+    // path only serves one file.
+    if (num_sinks != 2 || fstat(in, &st) != 0 || !S_ISFIFO(st.st_mode) || fstat(out, &st) != 0)
+    {
+        return false;
+    }
+    if (!S_ISFIFO(st.st_mode) && pipe(stage) != 0)
+    {
+        return false;
+    }
+
+    for (;;)
+    {
+        // Duplicate the next chunk without consuming it, tee returns 0 once the writers are gone and the pipe is empty.
+        ssize_t length = tee(in, (stage[1] >= 0) ? stage[1] : out, SPLICECHUNK, 0);
+        if (length < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (length < 0)
+        {
+            unsupported = true;
+            break;
+        }
+        if (length == 0)
+        {
+            break;
+        }
+
+        // Drain the staging pipe into stdout, then consume the chunk from the input into the file.
+        if ((stage[0] >= 0 && !splice_all(stage[0], out, length, &unsupported)) || !splice_all(in, file, length, &unsupported))
+        {
+            fprintf(stderr, "Could not write output.\n");
+            exit(1);
+        }
+        if (unsupported)
+        {
+            break;
+        }
+    }
+
+    if (stage[0] >= 0)
+    {
+        close(stage[0]);
+        close(stage[1]);
+    }
+    return !unsupported;
+}
+
+/// @brief Restores the input of a compressed file: checks the magic, then reads one frame at a time and writes the block it holds.
+/// @param in The file descriptor of the compressed file.
+/// @param out The file descriptor to write the blocks to.
+/// @return False if the file is not compressed or is corrupt.
+bool decompress_stream(int in, int out)
+{
+    char header[FRAMEHEADER], *frame = NULL, *block = NULL;
+    size_t capacity = 0;
+    bool valid = read_full(in, header, strlen(FRAMEMAGIC)) == strlen(FRAMEMAGIC) && memcmp(header, FRAMEMAGIC, strlen(FRAMEMAGIC)) == 0;
+
+    while (valid)
+    {
+        size_t got = read_full(in, header, FRAMEHEADER);
+        if (got == 0)
+        {
+            break;
+        }
+
+        // A block that does not compress is stored as it is, so the stored length never exceeds the length of the block.
+        uint32_t length = frame_get32(header), stored = frame_get32(header + 4);
+        if (got < FRAMEHEADER || stored > length)
+        {
+            valid = false;
+            break;
+        }
+        if (length > capacity)
+        {
+            free(frame);
+            free(block);
+            capacity = length;
+            frame = (char *)malloc(capacity);
+            block = (char *)malloc(capacity);
+            if (frame == NULL || block == NULL)
+            {
+                fprintf(stderr, "Out of memory.\n");
+                exit(1);
+            }
+        }
+
+        if (read_full(in, frame, stored) < stored)
+        {
+            valid = false;
+        }
+        else if (stored == length)
+        {
+            write_block(out, frame, length);
+        }
+        else if (lz_decompress(frame, stored, block, length) != (long)length)
+        {
+            valid = false;
+        }
+        else
+        {
+            write_block(out, block, length);
+        }
+    }
+
+    free(frame);
+    free(block);
+    return valid;
+}
+
+/// @brief Starts a child process that writes generated lines into a pipe.
+/// @param megabytes The amount of lines to write.
+/// @param child Set to the process id of the child.
+/// @return The read end of the pipe.
+int start_generator(long megabytes, pid_t *child)
+{
+    int fds[2];
+
+    if (pipe(fds) != 0 || (*child = fork()) < 0)
+    {
+        fprintf(stderr, "Could not start the benchmark input.\n");
+        exit(1);
+    }
+    if (*child > 0)
+    {
+        close(fds[1]);
+        return fds[0];
+    }
+
+    // Generate one megabyte of lines and write it over and over, so the child costs little next to the tee being measured.
+    char *chunk = malloc(BENCHCHUNK);
+    for (long i = 0; i < BENCHCHUNK / BENCHLINE; i++)
+    {
+        char *line = chunk + i * BENCHLINE;
+        int length = sprintf(line, "%ld ", i);
+        memset(line + length, 'a' + i % 26, BENCHLINE - 1 - length);
+        line[BENCHLINE - 1] = '\n';
+    }
+    close(fds[0]);
+    for (long i = 0; i < megabytes; i++)
+    {
+        for (size_t done = 0; done < BENCHCHUNK;)
+        {
+            ssize_t written = write(fds[1], chunk + done, BENCHCHUNK - done);
+            if (written <= 0)
+            {
+                _exit(1);
+            }
+            done += written;
+        }
+    }
+    _exit(0);
+}
+
+/// @brief The ways the benchmark tees its input, a queue of NUM_QUEUES stands for splice.
+const struct
+{
+    const char *name;
+    QueueKind queue;
+    WriterKind writer;
+    bool compress; // Compress every sink but the first.
+} bench_paths[] = {
+    {"ring", QUEUE_RING, WRITER_THREADS, false},
+    {"mutex", QUEUE_MUTEX, WRITER_THREADS, false},
+    {"uring", QUEUE_RING, WRITER_URING, false},
+    {"splice", NUM_QUEUES, WRITER_THREADS, false},
+    {"lz", QUEUE_RING, WRITER_THREADS, true},
+};
+#define NUM_BENCH_PATHS (int)(sizeof(bench_paths) / sizeof(bench_paths[0]))
+
+/// @brief Tees generated input from a pipe to num_sinks sinks that all write to /dev/null.
+/// @param megabytes The amount of input to generate.
+/// @param path The index of the path in bench_paths.
+/// @return The elapsed time, or a negative time if splice is not supported.
+double bench_run(long megabytes, int path)
+{
+    pid_t child;
+    int in = start_generator(megabytes, &child);
+    double start = read_timer();
+    bool done = true;
+
+    sinks = (Sink *)calloc(num_sinks, sizeof(Sink));
+    for (int i = 0; i < num_sinks; i++)
+    {
+        sinks[i].descriptor = open("/dev/null", O_WRONLY);
+        sinks[i].compress = bench_paths[path].compress && i > 0;
+    }
+
+    peak_memory = 0;
+    writer = bench_paths[path].writer;
+    if (bench_paths[path].queue == NUM_QUEUES)
+    {
+        done = splice_tee(in);
+    }
+    else
+    {
+        input_descriptor = in;
+        run_tee(bench_paths[path].queue);
+    }
+    double elapsed = read_timer() - start;
+
+    close(in);
+    waitpid(child, NULL, 0);
+    for (int i = 0; i < num_sinks; i++)
+    {
+        close(sinks[i].descriptor);
+    }
+    free(sinks);
+    return done ? elapsed : -1;
+}
+
+/// @brief Prints the throughput of every path for stdout and one file, and then the aggregate throughput of the threaded paths as the
+/// number of sinks grows. All sinks write to /dev/null so only the handoff and the copies are measured.
+/// @param megabytes The amount of input to generate.
+void run_benchmark(long megabytes)
+{
+    double bytes = (double)megabytes * BENCHCHUNK;
+
+    num_sinks = 2;
+    printf("%-6s %14s %10s %10s %12s\n", "path", "bytes", "time (s)", "MB/s", "peak memory");
+    for (int path = 0; path < NUM_BENCH_PATHS; path++)
+    {
+        double elapsed = bench_run(megabytes, path);
+
+        if (elapsed < 0)
+        {
+            printf("%-6s not supported here\n", bench_paths[path].name);
+            continue;
+        }
+        printf("%-6s %14.0f %10.3f %10.1f %12zu\n", bench_paths[path].name, bytes, elapsed, bytes / elapsed / 1e6, peak_memory);
+        if (bench_paths[path].compress)
+        {
+            printf("%-6s frames are %.1f%% of the input\n", "", 100.0 * atomic_load(&compressed_bytes) / atomic_load(&compressed_input));
+        }
+    }
+
+    printf("\n%-6s %6s %10s %14s %12s\n", "path", "sinks", "time (s)", "aggregate MB/s", "peak memory");
+    for (int path = 0; path < NUM_BENCH_PATHS; path++)
+    {
+        for (num_sinks = bench_paths[path].compress ? 2 : 1; bench_paths[path].queue != NUM_QUEUES && num_sinks <= BENCHSINKS; num_sinks *= 2)
+        {
+            double elapsed = bench_run(megabytes, path);
+            printf("%-6s %6d %10.3f %14.1f %12zu\n", bench_paths[path].name, num_sinks, elapsed, num_sinks * bytes / elapsed / 1e6,
+                   peak_memory);
+        }
+    }
+}
 
 /// @brief The main function of the program.
 /// @param argc The number of arguments.
@@ -44,54 +1270,545 @@ FILE *file_pointer;
 /// @return The exit code of the program.
 int main(int argc, char *argv[])
 {
+    QueueKind queue = QUEUE_RING;
+    long bench = 0;
+    bool use_splice = true, verbose = false, decompress = false;
+    int opt;
+
+    spins = (sysconf(_SC_NPROCESSORS_ONLN) > 1) ? SPINS : 0;
+    compress_threads = sysconf(_SC_NPROCESSORS_ONLN);
+
+    static struct option long_options[] = {
+        {"queue", required_argument, NULL, 'q'},
+        {"bench", optional_argument, NULL, 'b'},
+        {"no-splice", no_argument, NULL, 'n'},
+        {"block-size", required_argument, NULL, 's'},
+        {"memory", required_argument, NULL, 'M'},
+        {"verbose", no_argument, NULL, 'v'},
+        {"lag", required_argument, NULL, 'l'},
+        {"writer", required_argument, NULL, 'w'},
+        {"direct", no_argument, NULL, 'd'},
+        {"fsync", required_argument, NULL, 'f'},
+        {"compress", no_argument, NULL, 'z'},
+        {"compress-threads", required_argument, NULL, 'j'},
+        {"decompress", no_argument, NULL, 'x'},
+        {"stats", optional_argument, NULL, 't'},
+        {NULL, 0, NULL, 0}};
+
+    // Read the options.
+    while ((opt = getopt_long(argc, argv, "q:b::ns:M:vl:w:df:zj:xt::", long_options, NULL)) != -1)
+    {
+        switch (opt)
+        {
+        case 'q':
+            for (queue = 0; queue < NUM_QUEUES && strcmp(optarg, queue_names[queue]) != 0; queue++)
+                ;
+            if (queue == NUM_QUEUES)
+            {
+                printf("Unknown queue: %s\n", optarg);
+                exit(1);
+            }
+            break;
+        case 'b':
+            bench = (optarg != NULL) ? atol(optarg) : BENCHMB;
+            if (bench < 1)
+            {
+                bench = 1;
+            }
+            break;
+        case 'n':
+            use_splice = false;
+            break;
+        case 's':
+            block_size = strtoul(optarg, NULL, 0);
+            if (block_size < 1)
+            {
+                block_size = 1;
+            }
+            break;
+        case 'M':
+            memory_cap = strtoul(optarg, NULL, 0);
+            break;
+        case 'v':
+            verbose = true;
+            break;
+        case 'l':
+            lag = strtoul(optarg, NULL, 0);
+            if (lag < 1)
+            {
+                lag = 1;
+            }
+            break;
+        case 'w':
+            for (writer = 0; writer < NUM_WRITERS && strcmp(optarg, writer_names[writer]) != 0; writer++)
+                ;
+            if (writer == NUM_WRITERS)
+            {
+                printf("Unknown writer: %s\n", optarg);
+                exit(1);
+            }
+            break;
+        case 'd':
+            direct_io = true;
+            break;
+        case 'f':
+            // never, end, or a number of blocks between fdatasync calls, which also syncs at the end.
+            fsync_every = strcmp(optarg, "never") == 0 || strcmp(optarg, "end") == 0 ? 0 : atol(optarg);
+            fsync_at_end = strcmp(optarg, "end") == 0;
+            if (!fsync_at_end && strcmp(optarg, "never") != 0 && fsync_every < 1)
+            {
+                printf("Unknown fsync policy: %s\n", optarg);
+                exit(1);
+            }
+            break;
+        case 'z':
+            compress = true;
+            break;
+        case 'j':
+            compress_threads = atoi(optarg);
+            if (compress_threads < 1)
+            {
+                compress_threads = 1;
+            }
+            break;
+        case 'x':
+            decompress = true;
+            break;
+        case 't':
+            stats_enabled = true;
+            stats_interval = (optarg != NULL) ? atof(optarg) : 0;
+            break;
+        default:
+            printf("Usage: %s [-q ring|mutex] [-w threads|uring] [-n] [-s bytes] [-M bytes] [-l blocks]\n"
+                   "       [-d] [-f never|end|blocks] [-z [-j threads]] [-t[seconds]] [-v] file...\n"
+                   "       %s --decompress < file\n"
+                   "       %s --bench[=MB]\n",
+                   argv[0], argv[0], argv[0]);
+            exit(1);
+        }
+    }
+
+    if (bench > 0)
+    {
+        run_benchmark(bench);
+        return 0;
+    }
+    if (decompress)
+    {
+        if (!decompress_stream(STDIN_FILENO, STDOUT_FILENO))
+        {
+            fprintf(stderr, "The input is not a complete compressed file.\n");
+            exit(1);
+        }
+        return 0;
+    }
+
     // Check if the file name is provided.
-    if (argc < 2)
+    if (optind >= argc)
     {
         printf("Missing arguments. %d\n", argc);
         exit(1);
     }
 
-    // Open the file.
-    file_pointer = fopen(argv[1], "w+");
-    if (file_pointer == NULL)
+    if (writer == WRITER_URING && queue != QUEUE_RING)
     {
-        printf("Could not open file.\n");
+        printf("The uring writer needs the ring queue.\n");
         exit(1);
     }
+    if (compress && (queue != QUEUE_RING || direct_io))
+    {
+        printf("Compression needs the ring queue and cannot be combined with --direct.\n");
+        exit(1);
+    }
+    if (direct_io)
+    {
+        // O_DIRECT needs aligned lengths, and splice would bypass the aligned buffers.
+        block_size = (block_size + DIRECTALIGN - 1) & ~(size_t)(DIRECTALIGN - 1);
+        use_splice = false;
+    }
+    if (compress)
+    {
+        // The files get frames, not the bytes splice would move.
+        use_splice = false;
+    }
+    if (stats_enabled)
+    {
+        // Splice moves the bytes past every counter. SIGUSR1 is blocked before any thread starts, so only the reporter takes it.
+        sigset_t signals;
+        sigemptyset(&signals);
+        sigaddset(&signals, SIGUSR1);
+        pthread_sigmask(SIG_BLOCK, &signals, NULL);
+        use_splice = false;
+    }
 
-    // Create thread variables.
-    pthread_attr_t attr;
-    pthread_t read_thread, stdout_thread, write_thread;
-
-    // Set the thread attributes.
-    pthread_attr_init(&attr);
-    pthread_attr_setscope(&attr, PTHREAD_SCOPE_SYSTEM);
+    // Open the files, every one of them is a sink next to stdout.
+    num_sinks = 1 + argc - optind;
+    sinks = (Sink *)calloc(num_sinks, sizeof(Sink));
+    sinks[0].descriptor = STDOUT_FILENO;
+    for (int i = 0; i < num_sinks; i++)
+    {
+        struct stat st;
+        const char *path = argv[optind + i - 1];
 
-    // Create the initial block.
-    initial_block = (TaskBlock *)malloc(sizeof(TaskBlock));
-    initial_block->next_block = NULL;
-    initial_block->tail = &initial_block->tasks[0];
+        if (i > 0)
+        {
+            // Not every file system supports O_DIRECT, such files are written through the page cache.
+            sinks[i].direct = direct_io;
+            sinks[i].descriptor = open(path, O_RDWR | O_CREAT | O_TRUNC | (direct_io ? O_DIRECT : 0), 0666);
+            if (sinks[i].descriptor < 0 && direct_io && errno == EINVAL)
+            {
+                sinks[i].direct = false;
+                sinks[i].descriptor = open(path, O_RDWR | O_CREAT | O_TRUNC, 0666);
+            }
+            if (sinks[i].descriptor < 0)
+            {
+                printf("Could not open file %s.\n", path);
+                exit(1);
+            }
 
-    // Init the first task's mutex and lock it so the read thread can start reading.
-    pthread_mutex_init(&initial_block->tail->mutex, NULL);
-    pthread_mutex_lock(&initial_block->tail->mutex);
+            // Every compressed file starts with the magic, followed by one frame per block.
+            sinks[i].compress = compress;
+            if (compress)
+            {
+                write_block(sinks[i].descriptor, FRAMEMAGIC, strlen(FRAMEMAGIC));
+            }
+        }
+        sinks[i].regular = fstat(sinks[i].descriptor, &st) == 0 && S_ISREG(st.st_mode);
+    }
 
-    // Create the threads.
-    pthread_create(&read_thread, &attr, read_worker, NULL);
-    pthread_create(&stdout_thread, &attr, stdout_worker, NULL);
-    pthread_create(&write_thread, &attr, write_worker, NULL);
+    input_descriptor = STDIN_FILENO;
 
-    // Wait for the threads to finish.
-    pthread_join(read_thread, NULL);
-    pthread_join(stdout_thread, NULL);
-    pthread_join(write_thread, NULL);
+    // Use the zero-copy path when the file descriptors allow it, the threaded path otherwise or for whatever input it left.
+    if (!use_splice || !splice_tee(STDIN_FILENO))
+    {
+        run_tee(queue);
+    }
+    if (verbose)
+    {
+        fprintf(stderr, "Peak buffer memory: %zu bytes.\n", peak_memory);
+        if (compress)
+        {
+            fprintf(stderr, "Compressed %zu bytes into %zu bytes of frames.\n", atomic_load(&compressed_input), atomic_load(&compressed_bytes));
+        }
+    }
 
-    // Close the file.
-    fclose(file_pointer);
+    // Close the files.
+    for (int i = 1; i < num_sinks; i++)
+    {
+        close(sinks[i].descriptor);
+    }
+    free(sinks);
 
     return 0;
 }
 
+/// @brief This function reads blocks from the input and publishes them in the ring, waiting while the slowest sink is lag blocks behind.
+void *ring_read_worker()
+{
+    unsigned head = 0;
+
+    for (;;)
+    {
+        // Wait until every sink is done with the slot this block goes into.
+        unsigned long long waited = stats_clock();
+        for (int i = 0; i < num_sinks; i++)
+        {
+            unsigned tail;
+            while (head - (tail = atomic_load_explicit(&ring.tails[i].position, memory_order_acquire)) >= ring.lag)
+            {
+                cursor_wait(&ring.tails[i], tail);
+            }
+        }
+
+        Slot *slot = &ring.slots[head & (ring.size - 1)];
+        slot->Buffer = (char *)pool_get(&buffer_pool);
+        stats_blocked(&reader_stats, waited);
+        slot->length = read_block(input_descriptor, slot->Buffer, block_size);
+        if (slot->length == 0)
+        {
+            pool_put(&buffer_pool, slot->Buffer);
+            break;
+        }
+        slot->read_at = stats_clock();
+        stats_block(&reader_stats, slot->length, 0);
+        slot->Compressed = NULL;
+        atomic_store_explicit(&slot->references, num_sinks, memory_order_relaxed);
+
+        // Publishing the new head releases the block to the sinks.
+        cursor_move(&ring.head, ++head);
+    }
+
+    // Close the ring and wake the sinks waiting for more blocks.
+    cursor_close(&ring.head);
+    pthread_exit(0);
+}
+
+/// @brief This function writes every block of the ring to one sink, in order.
+/// @param arg The index of the sink.
+void *ring_sink_worker(void *arg)
+{
+    long id = (long)arg;
+    Cursor *cursor = &ring.tails[id];
+    Sink *sink = &sinks[id];
+    Stats *stats = &sink_stats[id];
+    unsigned tail = 0;
+
+    for (;;)
+    {
+        // Check closed before head, so a closed ring with nothing past tail really is drained.
+        bool closed = atomic_load(&ring.head.closed);
+        unsigned head = atomic_load_explicit(&ring.head.position, memory_order_acquire);
+
+        if (tail == head)
+        {
+            if (closed)
+            {
+                break;
+            }
+            unsigned long long waited = stats_clock();
+            cursor_wait(&ring.head, head);
+            stats_blocked(stats, waited);
+            continue;
+        }
+
+        // Write every published block, then hand the slots back to the reader.
+        for (; tail != head; tail++)
+        {
+            Slot *slot = &ring.slots[tail & (ring.size - 1)];
+            size_t length;
+            unsigned long long waited = stats_clock();
+            const char *data = slot_data(slot, tail, sink, &length);
+            stats_blocked(stats, waited);
+            sink_write(sink, data, length);
+            stats_block(stats, slot->length, length);
+            stats_latency(stats, slot->read_at);
+            slot_release(slot);
+        }
+        cursor_move(cursor, tail);
+    }
+
+    sink_finish(sink);
+    pthread_exit(0);
+}
+
+/// @brief This function writes every block of the ring to all sinks from one thread through io_uring. Each round it submits the next
+/// operation of every idle sink in one batch, the rest of its oldest unwritten block or an fsync the policy asks for, and then waits
+/// for at least one of them to complete. A sink has at most one operation in flight, so its writes stay in order.
+/// @param arg The io_uring instance.
+void *uring_writer(void *arg)
+{
+    Uring *uring = (Uring *)arg;
+    UringSink *states = (UringSink *)calloc(num_sinks, sizeof(UringSink));
+    int finished = 0;
+
+    while (finished < num_sinks)
+    {
+        // Check closed before head, so a closed ring with nothing past a tail really is drained for that sink.
+        bool closed = atomic_load(&ring.head.closed);
+        unsigned head = atomic_load_explicit(&ring.head.position, memory_order_acquire);
+        int in_flight = 0;
+        Cursor *blocked = NULL; // A compression cursor some sink waits for.
+        unsigned blocked_at = 0;
+
+        for (int i = 0; i < num_sinks; i++)
+        {
+            UringSink *state = &states[i];
+            Sink *sink = &sinks[i];
+
+            if (state->op != OP_NONE)
+            {
+                in_flight++;
+                continue;
+            }
+            if (state->finished || (state->tail == head && !closed && !state->sync_due))
+            {
+                continue;
+            }
+            if (state->tail == head && !state->sync_due && (state->synced || !sink_needs_final_sync(sink)))
+            {
+                state->finished = true;
+                finished++;
+                continue;
+            }
+
+            // A compressed sink can only write a block once its frame is ready.
+            bool writing = !state->sync_due && state->tail != head;
+            if (writing && sink->compress && !block_compressed(state->tail, &blocked, &blocked_at))
+            {
+                continue;
+            }
+
+            struct io_uring_sqe *sqe = uring_sqe(uring);
+            sqe->fd = sink->descriptor;
+            sqe->user_data = i;
+            if (!writing)
+            {
+                sqe->opcode = IORING_OP_FSYNC;
+                sqe->fsync_flags = state->sync_due ? IORING_FSYNC_DATASYNC : 0;
+                state->op = state->sync_due ? OP_SYNC : OP_FINAL_SYNC;
+            }
+            else
+            {
+                size_t length;
+                const char *data = slot_data(&ring.slots[state->tail & (ring.size - 1)], state->tail, sink, &length);
+                if (sink->direct && length % DIRECTALIGN != 0)
+                {
+                    sink_drop_direct(sink);
+                }
+
+                // An offset of -1 writes at the current file position, like write(2), which also works for pipes.
+                sqe->opcode = IORING_OP_WRITE;
+                sqe->addr = (uintptr_t)(data + state->written);
+                sqe->len = length - state->written;
+                sqe->off = (uint64_t)-1;
+                state->op = OP_WRITE;
+            }
+            in_flight++;
+        }
+
+        if (finished == num_sinks)
+        {
+            break;
+        }
+        if (in_flight == 0)
+        {
+            // Every unfinished sink has written everything published so far, or waits for a block to be compressed.
+            unsigned long long waited = stats_clock();
+            if (blocked != NULL)
+            {
+                cursor_wait(blocked, blocked_at);
+            }
+            else
+            {
+                cursor_wait(&ring.head, head);
+            }
+            for (int i = 0; i < num_sinks; i++)
+            {
+                if (!states[i].finished)
+                {
+                    stats_blocked(&sink_stats[i], waited);
+                }
+            }
+            continue;
+        }
+        if (!uring_enter(uring, 1))
+        {
+            fprintf(stderr, "Could not submit output: %s.\n", strerror(errno));
+            exit(1);
+        }
+
+        struct io_uring_cqe *cqe;
+        while ((cqe = uring_cqe(uring)) != NULL)
+        {
+            int i = (int)cqe->user_data, result = cqe->res;
+            UringSink *state = &states[i];
+            int op = state->op;
+
+            uring_cqe_seen(uring);
+            state->op = OP_NONE;
+
+            // Interrupted operations are submitted again in the next round.
+            if (result == -EINTR || result == -EAGAIN)
+            {
+                continue;
+            }
+            if (result < 0 || (op == OP_WRITE && result == 0))
+            {
+                fprintf(stderr, "Could not %s output: %s.\n", op == OP_WRITE ? "write" : "sync", strerror(result < 0 ? -result : EIO));
+                exit(1);
+            }
+
+            if (op == OP_SYNC)
+            {
+                state->sync_due = false;
+            }
+            else if (op == OP_FINAL_SYNC)
+            {
+                state->synced = true;
+            }
+            else
+            {
+                // A short write leaves the rest of the block for the next round, a complete one releases the block.
+                Slot *slot = &ring.slots[state->tail & (ring.size - 1)];
+                size_t length;
+                slot_data(slot, state->tail, &sinks[i], &length);
+                state->written += result;
+                if (state->written == length)
+                {
+                    state->written = 0;
+                    stats_block(&sink_stats[i], slot->length, length);
+                    stats_latency(&sink_stats[i], slot->read_at);
+                    slot_release(slot);
+                    cursor_move(&ring.tails[i], ++state->tail);
+                    state->sync_due = sink_block_written(&sinks[i]);
+                }
+            }
+        }
+    }
+
+    free(states);
+    pthread_exit(0);
+}
+
+/// @brief This function compresses its share of the blocks of the ring into frames for the compressed sinks. A frame is a header with
+/// the length of the block and the length of what follows, which is the block itself when it does not compress.
+/// @param arg The index of the compression thread.
+void *compress_worker(void *arg)
+{
+    long id = (long)arg;
+    Cursor *cursor = &ring.compressors[id];
+    Stats *stats = &compress_stats[id];
+    uint32_t *table = (uint32_t *)malloc(LZ_TABLESIZE * sizeof(uint32_t));
+    unsigned next = id;
+    size_t consumed = 0, produced = 0;
+
+    for (;;)
+    {
+        // Check closed before head, so a closed ring without the next block really has no more blocks for this thread.
+        bool closed = atomic_load(&ring.head.closed);
+        unsigned head = atomic_load_explicit(&ring.head.position, memory_order_acquire);
+
+        if ((int)(head - next) <= 0)
+        {
+            if (closed)
+            {
+                break;
+            }
+            unsigned long long waited = stats_clock();
+            cursor_wait(&ring.head, head);
+            stats_blocked(stats, waited);
+            continue;
+        }
+
+        Slot *slot = &ring.slots[next & (ring.size - 1)];
+        unsigned long long waited = stats_clock();
+        char *frame = (char *)pool_get(&frame_pool);
+        stats_blocked(stats, waited);
+        size_t stored = lz_compress(slot->Buffer, slot->length, frame + FRAMEHEADER, table);
+        if (stored >= slot->length)
+        {
+            stored = slot->length;
+            memcpy(frame + FRAMEHEADER, slot->Buffer, stored);
+        }
+        frame_put32(frame, slot->length);
+        frame_put32(frame + 4, stored);
+        slot->Compressed = frame;
+        slot->compressed_length = FRAMEHEADER + stored;
+        consumed += slot->length;
+        produced += slot->compressed_length;
+        stats_block(stats, slot->length, slot->compressed_length);
+
+        // Moving the cursor publishes the frame to the compressed sinks.
+        next += compress_threads;
+        cursor_move(cursor, next);
+    }
+
+    atomic_fetch_add(&compressed_input, consumed);
+    atomic_fetch_add(&compressed_bytes, produced);
+    free(table);
+    pthread_exit(0);
+}
+
 /// @brief This function reads input from stdin and creates tasks for the write and stdout threads.
 void *read_worker()
 {
@@ -100,10 +1817,22 @@ void *read_worker()
     Task *cur_task = &cur_block->tasks[0];
 
     // Read input from stdin and write it to the current task (which is locked from reading).
-    while (fgets(cur_task->Buffer, BUFFERSIZE, stdin))
+    for (;;)
     {
+        unsigned long long waited = stats_clock();
+        cur_task->Buffer = (char *)pool_get(&buffer_pool);
+        stats_blocked(&reader_stats, waited);
+        cur_task->length = read_block(input_descriptor, cur_task->Buffer, block_size);
+        if (cur_task->length == 0)
+        {
+            pool_put(&buffer_pool, cur_task->Buffer);
+            break;
+        }
+        cur_task->read_at = stats_clock();
+        stats_block(&reader_stats, cur_task->length, 0);
+
         // Init its variables.
-        cur_task->is_partially_processed = false;
+        cur_task->processed = 0;
 
         // Set the tail to the current task.
         cur_block->tail = cur_task;
@@ -119,7 +1848,7 @@ void *read_worker()
         else
         {
             // Create a new block.
-            TaskBlock *next_block = (TaskBlock *)malloc(sizeof(TaskBlock));
+            TaskBlock *next_block = (TaskBlock *)pool_get(&task_block_pool);
             next_block->next_block = NULL;
             next_block->tail = &next_block->tasks[0];
 
@@ -138,15 +1867,19 @@ void *read_worker()
         cur_task = next_task;
     }
 
-    // Release the last task's mutex and set the finished_reading flag to true.
+    // Release the last task's mutex, which is empty, and set the finished_reading flag to true.
     pthread_mutex_unlock(&cur_task->mutex);
     finished_reading = true;
     pthread_exit(0);
 }
 
-/// @brief This function processes tasks containing strings and calls process_task with task string as argument.
-void *task_worker(void (*process_task)(char *))
+/// @brief This function processes tasks containing blocks of bytes and writes every block to one sink. The last sink to process a task
+/// returns its buffer to the pool, and the last sink to process a whole task block recycles the block.
+/// @param arg The index of the sink.
+void *sink_worker(void *arg)
 {
+    Sink *sink = &sinks[(long)arg];
+    Stats *stats = &sink_stats[(long)arg];
     TaskBlock *cur_block = initial_block;
     Task *cur_task = &cur_block->tasks[0];
 
@@ -154,44 +1887,51 @@ void *task_worker(void (*process_task)(char *))
     while (!finished_reading || cur_block->next_block != NULL || cur_task <= cur_block->tail)
     {
         // Wait for the task to unlock and lock it.
+        unsigned long long waited = stats_clock();
         pthread_mutex_lock(&cur_task->mutex);
+        stats_blocked(stats, waited);
 
-        // Check if the buffer is a null terminator, and if so, break the loop.
-        if (cur_task->Buffer[0] == '\0')
+        // Check if the task is empty, and if so, break the loop.
+        if (cur_task->length == 0)
         {
             pthread_mutex_unlock(&cur_task->mutex);
             break;
         }
 
         // Manage output.
-        process_task(cur_task->Buffer);
+        sink_write(sink, cur_task->Buffer, cur_task->length);
+        stats_block(stats, cur_task->length, cur_task->length);
+        stats_latency(stats, cur_task->read_at);
+
+        // Return the buffer to the pool if the task has now been fully processed.
+        bool fully_processed = ++cur_task->processed == num_sinks;
+        if (fully_processed)
+        {
+            pool_put(&buffer_pool, cur_task->Buffer);
+        }
 
-        // If the task has been processed by the write thread, and
+        // If the task is the last one of its block, move on to the next block.
         if (cur_task == &cur_block->tasks[BLOCKSIZE - 1])
         {
             // Store the next block in a temporary pointer.
             TaskBlock *next_block = cur_block->next_block;
 
-            // Free the current block if it has been (now) fully processed.
-            if (cur_task->is_partially_processed == true)
-            {
-                free(cur_block);
-            }
-
-            // Set the current task as partially processed.
-            cur_task->is_partially_processed = true;
-
             // Unlock the task.
             pthread_mutex_unlock(&cur_task->mutex);
 
+            // Recycle the current block if it has been (now) fully processed.
+            if (fully_processed)
+            {
+                pool_put(&task_block_pool, cur_block);
+            }
+
             // Move to the next block and task.
             cur_block = next_block;
             cur_task = &cur_block->tasks[0];
         }
         else
         {
-            // Set the task as partially processed and unlock it.
-            cur_task->is_partially_processed = true;
+            // Unlock the task.
             pthread_mutex_unlock(&cur_task->mutex);
 
             // Move to the next task.
@@ -199,33 +1939,6 @@ void *task_worker(void (*process_task)(char *))
         }
     }
 
-    pthread_exit(0);
-}
-
-/// @brief This function processes the output to stdout. It is effectively called by the task_worker function.
-/// @param content The string to be printed to stdout.
-void process_stdout(char *content)
-{
-    printf("%s", content);
-}
-
-/// @brief This function processes the output to the file. It is effectively called by the task_worker function.
-/// @param content The string to be written to the file.
-void process_write(char *content)
-{
-    fprintf(file_pointer, "%s", content);
-}
-
-/// @brief This function is used by the stdout thread to process tasks and print them to stdout.
-void *stdout_worker()
-{
-    task_worker(process_stdout);
-    pthread_exit(0);
+    sink_finish(sink);
+    return NULL;
 }
-
-/// @brief This function is used by the write thread to process tasks and write them to the file.
-void *write_worker()
-{
-    task_worker(process_write);
-    pthread_exit(0);
-}
\ No newline at end of file
@@ -0,0 +1,182 @@
+/* a minimal io_uring wrapper on the raw system calls, for machines
+   without liburing
+
+   usage:
+	 Uring u;
+	 if (uring_init(&u, entries))    fails with errno set if the kernel
+	                                  has no io_uring or forbids it
+	 sqe = uring_sqe(&u);            fill in one submission, NULL when the
+	                                  submission queue is full
+	 uring_enter(&u, 1);             submit everything filled in and wait
+	                                  for at least one completion
+	 while ((cqe = uring_cqe(&u)))   read a completion
+	   uring_cqe_seen(&u);
+	 uring_destroy(&u);
+
+*/
+#ifndef URING_H
+#define URING_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+typedef struct
+{
+	int fd;
+	unsigned to_submit; /* filled in since the last uring_enter */
+
+	/* submission queue */
+	void *sq_ring;
+	size_t sq_ring_size;
+	atomic_uint *sq_head;
+	atomic_uint *sq_tail;
+	unsigned sq_mask;
+	unsigned sq_entries;
+	unsigned *sq_array;
+	struct io_uring_sqe *sqes;
+	unsigned sq_local_tail;
+
+	/* completion queue, shares sq_ring with IORING_FEAT_SINGLE_MMAP */
+	void *cq_ring;
+	size_t cq_ring_size;
+	atomic_uint *cq_head;
+	atomic_uint *cq_tail;
+	unsigned cq_mask;
+	struct io_uring_cqe *cqes;
+} Uring;
+
+static inline bool uring_init(Uring *u, unsigned entries)
+{
+	struct io_uring_params p;
+
+	memset(u, 0, sizeof(*u));
+	memset(&p, 0, sizeof(p));
+	u->fd = (int)syscall(__NR_io_uring_setup, entries, &p);
+	if (u->fd < 0)
+		return false;
+
+	/* plain writes at the current file position need IORING_FEAT_RW_CUR_POS */
+	if (!(p.features & IORING_FEAT_RW_CUR_POS))
+	{
+		close(u->fd);
+		errno = ENOTSUP;
+		return false;
+	}
+
+	u->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	u->cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP)
+	{
+		if (u->cq_ring_size > u->sq_ring_size)
+			u->sq_ring_size = u->cq_ring_size;
+		u->cq_ring_size = u->sq_ring_size;
+	}
+	u->sq_ring = mmap(NULL, u->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+	if (u->sq_ring == MAP_FAILED)
+	{
+		close(u->fd);
+		return false;
+	}
+	if (p.features & IORING_FEAT_SINGLE_MMAP)
+		u->cq_ring = u->sq_ring;
+	else
+	{
+		u->cq_ring = mmap(NULL, u->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_CQ_RING);
+		if (u->cq_ring == MAP_FAILED)
+		{
+			munmap(u->sq_ring, u->sq_ring_size);
+			close(u->fd);
+			return false;
+		}
+	}
+	u->sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd,
+				   IORING_OFF_SQES);
+	if (u->sqes == MAP_FAILED)
+	{
+		if (u->cq_ring != u->sq_ring)
+			munmap(u->cq_ring, u->cq_ring_size);
+		munmap(u->sq_ring, u->sq_ring_size);
+		close(u->fd);
+		return false;
+	}
+
+	u->sq_head = (atomic_uint *)((char *)u->sq_ring + p.sq_off.head);
+	u->sq_tail = (atomic_uint *)((char *)u->sq_ring + p.sq_off.tail);
+	u->sq_mask = *(unsigned *)((char *)u->sq_ring + p.sq_off.ring_mask);
+	u->sq_entries = p.sq_entries;
+	u->sq_array = (unsigned *)((char *)u->sq_ring + p.sq_off.array);
+	u->sq_local_tail = atomic_load_explicit(u->sq_tail, memory_order_relaxed);
+	u->cq_head = (atomic_uint *)((char *)u->cq_ring + p.cq_off.head);
+	u->cq_tail = (atomic_uint *)((char *)u->cq_ring + p.cq_off.tail);
+	u->cq_mask = *(unsigned *)((char *)u->cq_ring + p.cq_off.ring_mask);
+	u->cqes = (struct io_uring_cqe *)((char *)u->cq_ring + p.cq_off.cqes);
+	return true;
+}
+
+static inline void uring_destroy(Uring *u)
+{
+	munmap(u->sqes, u->sq_entries * sizeof(struct io_uring_sqe));
+	if (u->cq_ring != u->sq_ring)
+		munmap(u->cq_ring, u->cq_ring_size);
+	munmap(u->sq_ring, u->sq_ring_size);
+	close(u->fd);
+}
+
+/* next free submission entry, cleared, or NULL when the queue is full */
+static inline struct io_uring_sqe *uring_sqe(Uring *u)
+{
+	unsigned head = atomic_load_explicit(u->sq_head, memory_order_acquire);
+	struct io_uring_sqe *sqe;
+
+	if (u->sq_local_tail - head == u->sq_entries)
+		return NULL;
+	sqe = &u->sqes[u->sq_local_tail & u->sq_mask];
+	memset(sqe, 0, sizeof(*sqe));
+	u->sq_array[u->sq_local_tail & u->sq_mask] = u->sq_local_tail & u->sq_mask;
+	u->sq_local_tail++;
+	u->to_submit++;
+	return sqe;
+}
+
+/* submit the filled in entries and wait for at least wait_for completions;
+   returns false with errno set on failure */
+static inline bool uring_enter(Uring *u, unsigned wait_for)
+{
+	atomic_store_explicit(u->sq_tail, u->sq_local_tail, memory_order_release);
+	for (;;)
+	{
+		long done = syscall(__NR_io_uring_enter, u->fd, u->to_submit, wait_for, wait_for > 0 ? IORING_ENTER_GETEVENTS : 0,
+							NULL, 0);
+		if (done >= 0)
+		{
+			u->to_submit -= (unsigned)done;
+			return true;
+		}
+		if (errno != EINTR)
+			return false;
+	}
+}
+
+/* oldest unread completion, NULL if there is none */
+static inline struct io_uring_cqe *uring_cqe(Uring *u)
+{
+	unsigned head = atomic_load_explicit(u->cq_head, memory_order_relaxed);
+
+	if (head == atomic_load_explicit(u->cq_tail, memory_order_acquire))
+		return NULL;
+	return &u->cqes[head & u->cq_mask];
+}
+
+/* mark the completion returned by uring_cqe as read */
+static inline void uring_cqe_seen(Uring *u)
+{
+	atomic_fetch_add_explicit(u->cq_head, 1, memory_order_release);
+}
+
+#endif
@@ -1,111 +1,517 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <omp.h>
 #include <string.h>
-#include <ctype.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <limits.h>
+#include <getopt.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
-// Define the buffer size for reading the file.
-#define BUFFERSIZE 1024
+// Define the number of bytes the vectorized scans look at in one step.
+#define VECTORSIZE 16
+
+// Define the layout of the hash set: one cache line of entries per bucket, filled to at most three quarters.
+#define CACHELINE 64
+#define BUCKETENTRIES (CACHELINE / sizeof(uint64_t))
+
+// Define when the sort stops splitting: ranges below INSERTIONSORT words are insertion sorted, and ranges below TASKCUTOFF words are
+// sorted by the thread that found them instead of in a new task.
+#define INSERTIONSORT 16
+#define TASKCUTOFF 8192
+#define RADIXBUCKETS 256
+
+// Define how the search collects its hits: the lines are searched in blocks of RESULTBLOCK lines, which are also the unit the threads
+// are scheduled in, and the hits of every thread go into arrays that start with room for HITCAPACITY hits and double when full.
+#define RESULTBLOCK 256
+#define HITCAPACITY 256
+
+// Define the dictionaries of the benchmark: sizes from BENCHMIN words up to a limit by factors of 10, words of 1 to BENCHLENGTH letters,
+// and in the sparse dictionaries every BENCHSPARSE-th word the reverse of an earlier one so lookups also hit, in the dense ones every
+// BENCHDENSE-th word, which makes every word a hit.
+#define BENCHMIN 100000
+#define BENCHMAX 10000000
+#define BENCHLENGTH 12
+#define BENCHSPARSE 8
+#define BENCHDENSE 2
+
+// Define how often the sweep runs the search for every configuration, it keeps the fastest run.
+#define SWEEPREPEATS 3
+
+// Define the sharded mode: the input is read STREAMBUFFER bytes at a time, and split into shards of about SHARDSIZE bytes unless told
+// otherwise, at most SHARDMAX of them so that all the shards can be open at once.
+#define STREAMBUFFER (1 << 20)
+#define SHARDSIZE (64 << 20)
+#define SHARDMAX 512
+
+/// @brief A word in the arena: the offset of its first character, its length, and its hash once the hash set is built. Every word is
+/// followed by a null character.
+typedef struct Word
+{
+    size_t offset;
+    int length;
+    uint32_t hash;
+} Word;
+
+/// @brief A bucket of the hash set, one cache line of entries. An entry holds the hash of a word in its upper half and the index of the
+/// word plus one in its lower half, 0 is empty. Entries fill up from the front and are never removed, so a lookup stops at the first
+/// empty entry.
+typedef struct Bucket
+{
+    _Alignas(CACHELINE) _Atomic uint64_t entries[BUCKETENTRIES];
+} Bucket;
+
+/// @brief A word being sorted: 8 of its characters from the current depth on, in big-endian order and padded with null characters, so
+/// that comparing the prefixes as numbers compares the words at that depth without touching the arena.
+typedef struct SortEntry
+{
+    uint64_t prefix;
+    char *text;
+} SortEntry;
+
+/// @brief The kinds of hits the search collects.
+typedef enum
+{
+    HIT_PALINDROME,
+    HIT_SEMORDNILAP,
+    NUM_HITS
+} HitKind;
+
+/// @brief A growing array of hits.
+typedef struct HitVector
+{
+    char **items;
+    size_t count;
+    size_t capacity;
+} HitVector;
+
+/// @brief The hits of one thread, on a cache line of their own so that threads never write to the same line.
+typedef struct ThreadHits
+{
+    _Alignas(CACHELINE) HitVector vectors[NUM_HITS];
+} ThreadHits;
+
+/// @brief Where the hits of a block of lines are: the thread that searched the block, the first of its hits in the arrays of that thread
+/// and their number, and where they go in the results.
+typedef struct BlockHits
+{
+    int thread;
+    size_t start[NUM_HITS];
+    size_t count[NUM_HITS];
+    size_t offset[NUM_HITS];
+} BlockHits;
+
+/// @brief How the reversed words are looked up.
+typedef enum
+{
+    ENGINE_BINARY, // Binary search over the sorted lines.
+    ENGINE_HASH,   // The hash set over the arena, which needs no sorting.
+    NUM_ENGINES
+} EngineKind;
+
+const char *engine_names[NUM_ENGINES] = {"binary", "hash"};
+
+/// @brief How the blocks of lines are shared between the threads of the search.
+typedef enum
+{
+    SCHEDULE_STATIC,  // Equal runs of blocks handed out up front.
+    SCHEDULE_DYNAMIC, // Chunks of blocks taken by whichever thread is free.
+    SCHEDULE_GUIDED,  // Chunks that shrink as the blocks run out.
+    NUM_SCHEDULES
+} ScheduleKind;
+
+const char *schedule_names[NUM_SCHEDULES] = {"static", "dynamic", "guided"};
+const omp_sched_t schedule_kinds[NUM_SCHEDULES] = {omp_sched_static, omp_sched_dynamic, omp_sched_guided};
+
+/// @brief How the threads are pinned to the CPUs the program may run on.
+typedef enum
+{
+    BIND_NONE,   // Leave the threads to the operating system.
+    BIND_CLOSE,  // Thread i on CPU i, so neighbouring threads share caches.
+    BIND_SPREAD, // The threads evenly over all the CPUs, and so over the NUMA nodes.
+    NUM_BINDS
+} BindKind;
+
+const char *bind_names[NUM_BINDS] = {"none", "close", "spread"};
 
 // Create global variables for the program.
-FILE *file_pointer;
 int line_count, palindromes_count, semordnilaps_count;
+char *arena; // The lowercased words, laid out like the lines of the file with the newlines replaced by null characters.
+Word *words;
 char **lines;
+Bucket *hash_set;
+size_t hash_mask; // The number of buckets minus one, the number of buckets is a power of two.
+EngineKind engine = ENGINE_BINARY;
+BindKind bind = BIND_NONE;
+cpu_set_t allowed_cpus; // The CPUs the program may run on, as it was started.
 char **palindromes;
 char **semordnilaps;
 
-/// @brief Function used to count the number of lines in the input file.
-/// @return The number of lines in the file.
-int count_lines()
+/// @brief Function used to count the newline characters in a part of the file, 16 bytes at a time where SSE2 is available.
+/// @param data The bytes to scan.
+/// @param length The number of bytes.
+/// @return The number of newline characters.
+size_t count_newlines(const char *data, size_t length)
 {
-    // Initialize the count and a variable for the current character.
-    int count = 0;
-    char ch;
+    size_t count = 0, i = 0;
 
-    // Loop through all characters in the file.
-    while ((ch = fgetc(file_pointer)) != EOF)
+#if defined(__SSE2__)
+    // Compare 16 bytes at once and count the matches in the mask of the comparison.
+    const __m128i newline = _mm_set1_epi8('\n');
+    for (; i + VECTORSIZE <= length; i += VECTORSIZE)
     {
-        // Check if we found a newline character, and increment the count if we did.
-        if (ch == '\n')
+        __m128i chunk = _mm_loadu_si128((const __m128i *)(data + i));
+        count += __builtin_popcount(_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, newline)));
+    }
+#endif
+
+    // Count the rest one byte at a time.
+    for (; i < length; i++)
+    {
+        count += (data[i] == '\n');
+    }
+    return count;
+}
+
+/// @brief Function used to record a line that starts after a newline, unless the newline is the last character of the file.
+/// @param position The position of the newline.
+/// @param size The size of the file.
+/// @param line The index of the line, moved on to the next one.
+void add_line(size_t position, size_t size, int *line)
+{
+    if (position + 1 < size)
+    {
+        words[(*line)++].offset = position + 1;
+    }
+}
+
+/// @brief Function used to copy a part of the file into the arena: lowercases every character, replaces the newlines with null characters
+/// and records where the lines after them start. Works on 16 bytes at a time where SSE2 is available.
+/// @param data The mapped file.
+/// @param begin The first byte of the part.
+/// @param end The byte after the part.
+/// @param size The size of the file.
+/// @param line The index of the line after the first newline in the part.
+void copy_lines(const char *data, size_t begin, size_t end, size_t size, int line)
+{
+    size_t i = begin;
+
+#if defined(__SSE2__)
+    const __m128i newline = _mm_set1_epi8('\n');
+    const __m128i shift = _mm_set1_epi8(128 - 'A'), limit = _mm_set1_epi8(-128 + 26), lowercase = _mm_set1_epi8('a' - 'A');
+    for (; i + VECTORSIZE <= end; i += VECTORSIZE)
+    {
+        __m128i chunk = _mm_loadu_si128((const __m128i *)(data + i));
+        __m128i newlines = _mm_cmpeq_epi8(chunk, newline);
+
+        // Shifting 'A'..'Z' to the lowest signed bytes finds the uppercase letters with a single signed comparison.
+        __m128i uppercase = _mm_cmplt_epi8(_mm_add_epi8(chunk, shift), limit);
+        chunk = _mm_add_epi8(chunk, _mm_and_si128(uppercase, lowercase));
+        _mm_storeu_si128((__m128i *)(arena + i), _mm_andnot_si128(newlines, chunk));
+
+        // Every set bit of the mask is a newline, and the start of the next line.
+        for (int mask = _mm_movemask_epi8(newlines); mask != 0; mask &= mask - 1)
         {
-            count++;
+            add_line(i + __builtin_ctz(mask), size, &line);
         }
     }
+#endif
 
-    // Get the last char.
-    fseek(file_pointer, -1, SEEK_END);
-    ch = fgetc(file_pointer);
+    // Copy the rest one byte at a time.
+    for (; i < end; i++)
+    {
+        char ch = data[i];
+        if (ch == '\n')
+        {
+            arena[i] = '\0';
+            add_line(i, size, &line);
+        }
+        else
+        {
+            arena[i] = (ch >= 'A' && ch <= 'Z') ? ch + ('a' - 'A') : ch;
+        }
+    }
+}
 
-    // Add a line if the last character is not a newline.
-    if (ch != '\n')
+/// @brief Function used to read the lines from the input file. The file is mapped into memory and split into one part per thread: every
+/// thread counts the newlines of its part, a prefix sum of the counts gives each thread the index of its first line, and then every
+/// thread copies its part into the arena and records where its lines start.
+/// @param path The path of the file.
+/// @return 0 on success, 1 if the file could not be read or is empty.
+int read_lines(const char *path)
+{
+    // Open the file and map it into memory.
+    struct stat file_stat;
+    int descriptor = open(path, O_RDONLY);
+    if (descriptor < 0 || fstat(descriptor, &file_stat) != 0)
+    {
+        printf("Could not open file.\n");
+        return 1;
+    }
+    if (file_stat.st_size == 0)
     {
-        count++;
+        printf("Input file is empty.\n");
+        close(descriptor);
+        return 1;
     }
+    size_t size = file_stat.st_size;
+    const char *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+    close(descriptor);
+    if (data == MAP_FAILED)
+    {
+        printf("Could not map file.\n");
+        return 1;
+    }
+    madvise((void *)data, size, MADV_WILLNEED);
+
+    // Get the start time of the loading.
+    double start_time = omp_get_wtime();
 
-    // Return to the start of the file.
-    fseek(file_pointer, 0, SEEK_SET);
+    // The arena has room for a null character after a last line without a newline.
+    arena = malloc(size + 1);
+    arena[size] = '\0';
+    size_t *newlines_before = calloc(omp_get_max_threads() + 1, sizeof(size_t));
+    int trailing_newline = (data[size - 1] == '\n');
 
-    printf("Number of words: %d\n", count);
+    #pragma omp parallel
+    {
+        int thread = omp_get_thread_num(), threads = omp_get_num_threads();
+        size_t begin = size * thread / threads, end = size * (thread + 1) / threads;
 
-    // Return the number of lines we found.
-    return count;
+        // Count the newlines of the part, and add up the counts of the parts before each part.
+        newlines_before[thread + 1] = count_newlines(data + begin, end - begin);
+        #pragma omp barrier
+        #pragma omp single
+        {
+            for (int t = 0; t < threads; t++)
+            {
+                newlines_before[t + 1] += newlines_before[t];
+            }
+
+            // Add a line if the last character is not a newline.
+            line_count = newlines_before[threads] + !trailing_newline;
+            words = malloc(line_count * sizeof(Word));
+            lines = malloc(line_count * sizeof(char *));
+            words[0].offset = 0;
+        }
+
+        // Line 0 starts the file, and the n-th newline starts line n.
+        copy_lines(data, begin, end, size, newlines_before[thread] + 1);
+        #pragma omp barrier
+
+        // A line ends where the next one starts, minus its newline.
+        #pragma omp for
+        for (int i = 0; i < line_count; i++)
+        {
+            size_t line_end = (i + 1 < line_count) ? words[i + 1].offset - 1 : size - trailing_newline;
+            words[i].length = line_end - words[i].offset;
+            lines[i] = arena + words[i].offset;
+        }
+    }
+
+    // Unmap the file, everything is in the arena now.
+    munmap((void *)data, size);
+    free(newlines_before);
+
+    printf("Number of words: %d\n", line_count);
+    printf("Loading time: %f sec\n", omp_get_wtime() - start_time);
+    return 0;
 }
 
-/// @brief Function used to read the lines from the input file.
-void read_lines()
+/// @brief Function used to load the cached prefix of a word.
+/// @param text The characters of the word from the depth of the prefix on.
+/// @return Up to 8 characters in big-endian order, padded with null characters after the end of the word.
+uint64_t load_prefix(const char *text)
 {
-    // Count the number of lines/words in the files.
-    line_count = count_lines();
+    uint64_t prefix = 0;
+    for (int k = 0; k < 8 && text[k] != '\0'; k++)
+    {
+        prefix |= (uint64_t)(unsigned char)text[k] << (56 - 8 * k);
+    }
+    return prefix;
+}
 
-    // Allocate arrays for the maximum number of words.
-    lines = malloc(line_count * sizeof(char *));
+/// @brief Function used to compare two words being sorted, by their prefixes and only then by the rest of their characters.
+/// @param a The first word.
+/// @param b The other word to compare with.
+/// @param depth The depth of the prefixes.
+/// @return Integer of which order the first word compares to the other.
+int compare_entries(const SortEntry *a, const SortEntry *b, size_t depth)
+{
+    if (a->prefix != b->prefix)
+    {
+        return (a->prefix < b->prefix) ? -1 : 1;
+    }
 
-    // Create a buffer for reading the lines.
-    char buffer[BUFFERSIZE];
+    // Equal prefixes that end in a null character are equal words.
+    return ((a->prefix & 0xff) == 0) ? 0 : strcmp(a->text + depth + 8, b->text + depth + 8);
+}
 
-    // Read the lines from the file.
-    for (int i = 0; i < line_count; i++)
+/// @brief Function used to sort a small range of words with insertion sort.
+/// @param entries The words.
+/// @param count The number of words.
+/// @param depth The depth of their prefixes.
+void insertion_sort(SortEntry *entries, size_t count, size_t depth)
+{
+    for (size_t i = 1; i < count; i++)
     {
-        // Read the line from the file.
-        if (fgets(buffer, BUFFERSIZE, file_pointer) == NULL)
+        SortEntry entry = entries[i];
+        size_t j = i;
+        for (; j > 0 && compare_entries(&entry, &entries[j - 1], depth) < 0; j--)
         {
-            printf("Could not read line %d\n", i);
-            return;
+            entries[j] = entries[j - 1];
         }
+        entries[j] = entry;
+    }
+}
 
-        // Read each character in the line and convert it to lowercase.
-        for (char *p = buffer; *p; p++)
-        {
-            // Make the character lowercase.
-            *p = tolower(*p);
+/// @brief Function used to sort words that agree on their first depth characters with multikey quicksort on the cached prefixes. The
+/// words are split three ways around a pivot prefix: the smaller and the larger ones are sorted at the same depth, in new tasks when they
+/// are large, and the equal ones go on at the next 8 characters unless the pivot ends the word.
+/// @param entries The words.
+/// @param count The number of words.
+/// @param depth The number of characters the words agree on.
+void multikey_sort(SortEntry *entries, size_t count, size_t depth)
+{
+    while (count >= INSERTIONSORT)
+    {
+        // Take the median of the first, middle and last prefix as the pivot.
+        uint64_t a = entries[0].prefix, b = entries[count / 2].prefix, c = entries[count - 1].prefix;
+        uint64_t pivot = (a < b) ? ((b < c) ? b : (a < c) ? c : a) : ((a < c) ? a : (b < c) ? c : b);
 
-            // Replace the newline character with a null character.
-            if (*p == '\n')
+        // Split the words into smaller, equal and larger prefixes.
+        size_t less = 0, i = 0, greater = count;
+        while (i < greater)
+        {
+            SortEntry entry = entries[i];
+            if (entry.prefix < pivot)
+            {
+                entries[i++] = entries[less];
+                entries[less++] = entry;
+            }
+            else if (entry.prefix > pivot)
+            {
+                entries[i] = entries[--greater];
+                entries[greater] = entry;
+            }
+            else
             {
-                *p = '\0';
+                i++;
             }
         }
 
-        // Store the line in the array of words/lines.
-        lines[i] = strdup(buffer);
-    }
-}
+        // Sort the smaller and the larger words.
+        if (less >= TASKCUTOFF)
+        {
+            #pragma omp task
+            multikey_sort(entries, less, depth);
+        }
+        else
+        {
+            multikey_sort(entries, less, depth);
+        }
+        if (count - greater >= TASKCUTOFF)
+        {
+            #pragma omp task
+            multikey_sort(entries + greater, count - greater, depth);
+        }
+        else
+        {
+            multikey_sort(entries + greater, count - greater, depth);
+        }
 
-/// @brief Helper function used to compare two strings.
-/// @param a The first string.
-/// @param b The other string to compare with.
-/// @return Integer of which order the first string compares to the other.
-int compare_func(const void *a, const void *b)
-{
-    const char *first = *(const char **)a;
-    const char *second = *(const char **)b;
-    return strcmp(first, second);
+        // The equal words are the same word if the pivot ends it, otherwise load their next 8 characters and go on.
+        if ((pivot & 0xff) == 0)
+        {
+            return;
+        }
+        entries += less;
+        count = greater - less;
+        depth += 8;
+        for (size_t k = 0; k < count; k++)
+        {
+            entries[k].prefix = load_prefix(entries[k].text + depth);
+        }
+    }
+    insertion_sort(entries, count, depth);
 }
 
-/// @brief Function used to sort all the lines in the array.
+/// @brief Function used to sort all the lines in the array. A parallel MSD radix pass distributes the words by their first character,
+/// with a count per thread and character so every thread scatters its part of the lines into its own range of each bucket. The buckets
+/// are then sorted in parallel as tasks with multikey_sort.
 void sort_lines()
 {
-    qsort(lines, line_count, sizeof(char *), compare_func);
+    SortEntry *entries = malloc(line_count * sizeof(SortEntry));
+    size_t (*offsets)[RADIXBUCKETS] = calloc(omp_get_max_threads(), sizeof(*offsets));
+    size_t bucket_start[RADIXBUCKETS + 1];
+
+    #pragma omp parallel
+    {
+        int thread = omp_get_thread_num(), threads = omp_get_num_threads();
+        size_t begin = (size_t)line_count * thread / threads, end = (size_t)line_count * (thread + 1) / threads;
+
+        // Count the first characters of the part of the lines of this thread.
+        for (size_t i = begin; i < end; i++)
+        {
+            offsets[thread][(unsigned char)lines[i][0]]++;
+        }
+        #pragma omp barrier
+
+        // Turn the counts into the offset of every thread in every bucket.
+        #pragma omp single
+        {
+            size_t position = 0;
+            for (int b = 0; b < RADIXBUCKETS; b++)
+            {
+                bucket_start[b] = position;
+                for (int t = 0; t < threads; t++)
+                {
+                    size_t count = offsets[t][b];
+                    offsets[t][b] = position;
+                    position += count;
+                }
+            }
+            bucket_start[RADIXBUCKETS] = position;
+        }
+
+        // Scatter the lines into the buckets with their first prefixes.
+        for (size_t i = begin; i < end; i++)
+        {
+            entries[offsets[thread][(unsigned char)lines[i][0]]++] = (SortEntry){load_prefix(lines[i]), lines[i]};
+        }
+        #pragma omp barrier
+
+        // Sort every bucket in a task, the barrier at the end of the single region waits for all of them.
+        #pragma omp single
+        {
+            for (int b = 0; b < RADIXBUCKETS; b++)
+            {
+                if (bucket_start[b + 1] - bucket_start[b] > 1)
+                {
+                    #pragma omp task
+                    multikey_sort(entries + bucket_start[b], bucket_start[b + 1] - bucket_start[b], 0);
+                }
+            }
+        }
+
+        // Store the sorted lines.
+        #pragma omp for
+        for (int i = 0; i < line_count; i++)
+        {
+            lines[i] = entries[i].text;
+        }
+    }
+
+    free(offsets);
+    free(entries);
 }
 
 /// @brief Function used to find a specific string in the array.
@@ -137,79 +543,382 @@ int find_line(char *to_find)
     return -1;
 }
 
-/// @brief Function used to reverse a string.
-/// @param str A string pointer for the string to be reversed.
-void reverse_string(char *str)
+/// @brief Function used to hash a word: FNV-1a over its characters, finished with the mixing steps of MurmurHash3 so that the low bits
+/// that pick the bucket depend on every character.
+/// @param text The characters of the word.
+/// @param length The number of characters.
+/// @return The hash of the word.
+uint32_t hash_word(const char *text, int length)
 {
-    // Get the length of the string.
-    int len = strlen(str);
-
-    // Loop through half the string and swap the characters.
-    for (int i = 0; i < len / 2; i++)
+    uint32_t hash = 2166136261u;
+    for (int i = 0; i < length; i++)
     {
-        char temp = str[i];
-        str[i] = str[len - i - 1];
-        str[len - i - 1] = temp;
+        hash = (hash ^ (unsigned char)text[i]) * 16777619u;
     }
+
+    hash ^= hash >> 16;
+    hash *= 0x85ebca6bu;
+    hash ^= hash >> 13;
+    hash *= 0xc2b2ae35u;
+    hash ^= hash >> 16;
+    return hash;
 }
 
-/// @brief Function used to find the palindromes and semordnilaps in the array.
-void find_words()
+/// @brief Function used to build the hash set over the words in parallel. Every thread hashes its words and claims the first empty entry
+/// from the bucket of the hash on, with a compare-and-swap. A word that is already in the set is not added again, so duplicates in the
+/// dictionary do not grow the probe sequences.
+void build_hash_set()
 {
-    // Allocate array for palindromes and semordnilaps, and initialize counts.
-    palindromes = malloc(line_count * sizeof(char *));
-    semordnilaps = malloc(line_count * sizeof(char *));
-    palindromes_count = 0;
-    semordnilaps_count = 0;
+    // Find the number of buckets, a power of two with room for the words at three quarters load.
+    size_t buckets = 1;
+    while (buckets * BUCKETENTRIES * 3 < (size_t)line_count * 4)
+    {
+        buckets *= 2;
+    }
+    hash_mask = buckets - 1;
+    hash_set = aligned_alloc(CACHELINE, buckets * sizeof(Bucket));
 
-    // Get the start time of the concurrent part of the program.
-    double start_time = omp_get_wtime();
+    // Clear the buckets in parallel, which also spreads their pages over the threads that will touch them.
+    #pragma omp parallel for
+    for (size_t b = 0; b < buckets; b++)
+    {
+        memset(&hash_set[b], 0, sizeof(Bucket));
+    }
 
-    // Parallelize the for loop, between the threads.
     #pragma omp parallel for
     for (int i = 0; i < line_count; i++)
     {
-        // Set the current line.
-        char *current_line = lines[i];
+        uint32_t hash = hash_word(arena + words[i].offset, words[i].length);
+        uint64_t entry = (uint64_t)hash << 32 | (uint32_t)(i + 1);
+        int inserted = 0;
 
-        // Create a copy of the line.
-        char *reversed_line = strdup(current_line);
+        words[i].hash = hash;
+        for (size_t b = hash & hash_mask; !inserted; b = (b + 1) & hash_mask)
+        {
+            for (size_t e = 0; e < BUCKETENTRIES && !inserted; e++)
+            {
+                // Only try to claim entries that look empty, a failed claim leaves the entry another thread stored in current.
+                uint64_t current = atomic_load_explicit(&hash_set[b].entries[e], memory_order_relaxed);
+                if (current == 0 && atomic_compare_exchange_strong(&hash_set[b].entries[e], &current, entry))
+                {
+                    inserted = 1;
+                }
+                else if ((uint32_t)(current >> 32) == hash)
+                {
+                    int other = (uint32_t)current - 1;
+                    inserted = words[other].length == words[i].length &&
+                               memcmp(arena + words[other].offset, arena + words[i].offset, words[i].length) == 0;
+                }
+            }
+        }
+    }
+}
+
+/// @brief Function used to find a word in the hash set.
+/// @param text The characters of the word.
+/// @param length The number of characters.
+/// @param hash The hash of the word.
+/// @return The index of the word in the arena or -1 if it wasn't found.
+int find_word(const char *text, int length, uint32_t hash)
+{
+    for (size_t b = hash & hash_mask;; b = (b + 1) & hash_mask)
+    {
+        for (size_t e = 0; e < BUCKETENTRIES; e++)
+        {
+            uint64_t entry = atomic_load_explicit(&hash_set[b].entries[e], memory_order_relaxed);
+            if (entry == 0)
+            {
+                return -1;
+            }
 
-        // Reverse the line.
-        reverse_string(reversed_line);
+            // Only compare the characters when the hashes match.
+            int index = (uint32_t)entry - 1;
+            if ((uint32_t)(entry >> 32) == hash && words[index].length == length && memcmp(arena + words[index].offset, text, length) == 0)
+            {
+                return index;
+            }
+        }
+    }
+}
 
-        // Check if the reversed line is the same as the original line, or if it is a semordnilap.
-        if (strcmp(current_line, reversed_line) == 0)
+/// @brief Function used to check if a word is in the dictionary, with the selected engine.
+/// @param text The word, followed by a null character.
+/// @param length The number of characters.
+/// @return 1 if the word is in the dictionary, 0 otherwise.
+int contains_word(char *text, int length)
+{
+    if (engine == ENGINE_HASH)
+    {
+        return find_word(text, length, hash_word(text, length)) != -1;
+    }
+    return find_line(text) != -1;
+}
+
+#if defined(__SSE2__)
+/// @brief Function used to reverse the order of 16 bytes with SSE2: swap the bytes of every 16-bit lane, then reverse the lanes.
+/// @param chunk The bytes.
+/// @return The bytes in reverse order.
+__m128i reverse_chunk(__m128i chunk)
+{
+    chunk = _mm_or_si128(_mm_slli_epi16(chunk, 8), _mm_srli_epi16(chunk, 8));
+    chunk = _mm_shufflelo_epi16(chunk, _MM_SHUFFLE(0, 1, 2, 3));
+    chunk = _mm_shufflehi_epi16(chunk, _MM_SHUFFLE(0, 1, 2, 3));
+    return _mm_shuffle_epi32(chunk, _MM_SHUFFLE(1, 0, 3, 2));
+}
+#endif
+
+/// @brief Function used to check if a word reads the same backwards, comparing characters from both ends inwards. Long words compare 16
+/// characters from the front with 16 reversed characters from the back at a time where SSE2 is available.
+/// @param text The characters of the word.
+/// @param length The number of characters.
+/// @return 1 if the word is a palindrome, 0 otherwise.
+int is_palindrome(const char *text, int length)
+{
+    int i = 0;
+
+#if defined(__SSE2__)
+    for (; i + VECTORSIZE <= length / 2; i += VECTORSIZE)
+    {
+        __m128i front = _mm_loadu_si128((const __m128i *)(text + i));
+        __m128i back = reverse_chunk(_mm_loadu_si128((const __m128i *)(text + length - i - VECTORSIZE)));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(front, back)) != 0xffff)
         {
-            // Increment the count of the palindromes atomically.
-            int insert_index;
-            #pragma omp atomic capture
-            insert_index = palindromes_count++;
+            return 0;
+        }
+    }
+#endif
 
-            // Store the palindrome in the array.
-            palindromes[insert_index] = current_line;
+    for (; i < length / 2; i++)
+    {
+        if (text[i] != text[length - 1 - i])
+        {
+            return 0;
         }
-        else if (find_line(reversed_line) != -1)
+    }
+    return 1;
+}
+
+/// @brief Function used to write the reverse of a word into a buffer, 16 characters at a time where SSE2 is available.
+/// @param reversed The buffer, with room for the characters and a null character.
+/// @param text The characters of the word.
+/// @param length The number of characters.
+void reverse_word(char *reversed, const char *text, int length)
+{
+    int i = 0;
+
+#if defined(__SSE2__)
+    for (; i + VECTORSIZE <= length; i += VECTORSIZE)
+    {
+        __m128i chunk = _mm_loadu_si128((const __m128i *)(text + length - i - VECTORSIZE));
+        _mm_storeu_si128((__m128i *)(reversed + i), reverse_chunk(chunk));
+    }
+#endif
+
+    for (; i < length; i++)
+    {
+        reversed[i] = text[length - 1 - i];
+    }
+    reversed[length] = '\0';
+}
+
+/// @brief Function used to set the schedule of the search.
+/// @param kind How the blocks of lines are shared between the threads.
+/// @param chunk The number of lines handed out at a time, rounded up to whole blocks, or 0 for the default of the schedule.
+void set_schedule(ScheduleKind kind, int chunk)
+{
+    omp_set_schedule(schedule_kinds[kind], (chunk + RESULTBLOCK - 1) / RESULTBLOCK);
+}
+
+/// @brief Function used to pin the calling thread of a parallel region to one of the CPUs the program may run on, as set by bind. The
+/// threads pin themselves inside every region that does the work, since OpenMP does not promise to run later regions on the same threads.
+/// @return 0 on success, 1 if the thread could not be pinned.
+int bind_thread()
+{
+    if (bind == BIND_NONE)
+    {
+        return 0;
+    }
+
+    // Find the CPU of the thread among the CPUs the program may run on.
+    int num_cpus = CPU_COUNT(&allowed_cpus);
+    int thread = omp_get_thread_num();
+    int slot = (bind == BIND_SPREAD) ? (int)((long)thread * num_cpus / omp_get_num_threads()) : thread % num_cpus;
+    int cpu = 0;
+    for (int seen = 0; cpu < CPU_SETSIZE; cpu++)
+    {
+        if (CPU_ISSET(cpu, &allowed_cpus) && seen++ == slot)
         {
-            // Increment the count of the palindromes atomically.
-            int insert_index;
-            #pragma omp atomic capture
-            insert_index = semordnilaps_count++;
+            break;
+        }
+    }
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return sched_setaffinity(0, sizeof(set), &set) != 0;
+}
 
-            // Store the palindrome in the array.
-            semordnilaps[insert_index] = current_line;
+/// @brief Function used to let the calling thread run on all the CPUs the program may run on again at the end of a region, so the serial
+/// parts of the program and regions without pinning are not left on one CPU.
+/// @return 0 on success, 1 if the thread could not be unpinned.
+int unbind_thread()
+{
+    if (bind == BIND_NONE)
+    {
+        return 0;
+    }
+    return sched_setaffinity(0, sizeof(allowed_cpus), &allowed_cpus) != 0;
+}
+
+/// @brief Function used to report threads that could not be pinned or unpinned after a region, and to stop pinning from then on.
+/// @param failed Whether a thread of the region could not be pinned or unpinned.
+void check_binding(int failed)
+{
+    if (failed)
+    {
+        printf("Could not pin the threads to their CPUs, running them unpinned.\n");
+        bind = BIND_NONE;
+    }
+}
+
+/// @brief Function used to add a hit to a growing array of hits.
+/// @param vector The array.
+/// @param line The line that is a hit.
+void add_hit(HitVector *vector, char *line)
+{
+    if (vector->count == vector->capacity)
+    {
+        vector->capacity = (vector->capacity > 0) ? 2 * vector->capacity : HITCAPACITY;
+        vector->items = realloc(vector->items, vector->capacity * sizeof(char *));
+    }
+    vector->items[vector->count++] = line;
+}
+
+/// @brief Function used to find the palindromes and semordnilaps in the array. The lines are searched in blocks, and every thread keeps
+/// the hits of its blocks in its own arrays. A prefix sum over the hits of the blocks then gives every block its place in the results,
+/// so the hits come out in the order of the lines whichever thread found them, and the results take as much memory as there are hits.
+/// @return The time the concurrent processing took, in seconds.
+double find_words()
+{
+    int num_blocks = (line_count + RESULTBLOCK - 1) / RESULTBLOCK;
+    BlockHits *blocks = malloc(num_blocks * sizeof(BlockHits));
+    ThreadHits *thread_hits = aligned_alloc(CACHELINE, omp_get_max_threads() * sizeof(ThreadHits));
+    char **results[NUM_HITS];
+    memset(thread_hits, 0, omp_get_max_threads() * sizeof(ThreadHits));
+
+    // Get the start time of the concurrent part of the program.
+    double start_time = omp_get_wtime();
+
+    // Find the longest word, which sets the size of the buffers for the reversed words.
+    int longest = 0;
+    #pragma omp parallel for reduction(max : longest)
+    for (int i = 0; i < line_count; i++)
+    {
+        if (words[i].length > longest)
+        {
+            longest = words[i].length;
         }
+    }
 
-        // Free the memory of the line.
+    int bind_failed = 0;
+    #pragma omp parallel reduction(| : bind_failed)
+    {
+        // Pin the thread if asked to, and let every thread reverse its words into its own buffer, so the loop allocates nothing but room
+        // for hits.
+        bind_failed |= bind_thread();
+        int thread = omp_get_thread_num();
+        HitVector *vectors = thread_hits[thread].vectors;
+        char *reversed_line = malloc(longest + 1);
+
+        // Share the blocks between the threads by the schedule set with set_schedule.
+        #pragma omp for schedule(runtime)
+        for (int b = 0; b < num_blocks; b++)
+        {
+            int end = (b + 1 < num_blocks) ? (b + 1) * RESULTBLOCK : line_count;
+
+            // Remember where the hits of the block start.
+            blocks[b].thread = thread;
+            for (int k = 0; k < NUM_HITS; k++)
+            {
+                blocks[b].start[k] = vectors[k].count;
+            }
+
+            for (int i = b * RESULTBLOCK; i < end; i++)
+            {
+                // Set the current line. The lines are in sorted order for the binary search, where neighbouring lookups share their path.
+                char *current_line = lines[i];
+                int length = strlen(current_line);
+
+                // Check if the line reads the same backwards.
+                if (is_palindrome(current_line, length))
+                {
+                    add_hit(&vectors[HIT_PALINDROME], current_line);
+                    continue;
+                }
+
+                // Reverse the line into the buffer, and check if it is a semordnilap.
+                reverse_word(reversed_line, current_line, length);
+                if (contains_word(reversed_line, length))
+                {
+                    add_hit(&vectors[HIT_SEMORDNILAP], current_line);
+                }
+            }
+
+            for (int k = 0; k < NUM_HITS; k++)
+            {
+                blocks[b].count[k] = vectors[k].count - blocks[b].start[k];
+            }
+        }
         free(reversed_line);
+
+        // Add up the hits of the blocks before every block, and allocate the results.
+        #pragma omp single
+        {
+            for (int k = 0; k < NUM_HITS; k++)
+            {
+                size_t total = 0;
+                for (int b = 0; b < num_blocks; b++)
+                {
+                    blocks[b].offset[k] = total;
+                    total += blocks[b].count[k];
+                }
+                results[k] = malloc(total * sizeof(char *));
+            }
+            palindromes_count = blocks[num_blocks - 1].offset[HIT_PALINDROME] + blocks[num_blocks - 1].count[HIT_PALINDROME];
+            semordnilaps_count = blocks[num_blocks - 1].offset[HIT_SEMORDNILAP] + blocks[num_blocks - 1].count[HIT_SEMORDNILAP];
+        }
+
+        // Copy the hits of every block to their place in the results.
+        #pragma omp for
+        for (int b = 0; b < num_blocks; b++)
+        {
+            for (int k = 0; k < NUM_HITS; k++)
+            {
+                memcpy(results[k] + blocks[b].offset[k], thread_hits[blocks[b].thread].vectors[k].items + blocks[b].start[k],
+                       blocks[b].count[k] * sizeof(char *));
+            }
+        }
+        bind_failed |= unbind_thread();
     }
+    check_binding(bind_failed);
 
-    // Get the end time and calculate the elapsed time.
+    // Get the end time.
     double end_time = omp_get_wtime();
-    double elapsed = end_time - start_time;
 
-    // Print the elapsed time.
-    printf("Concurrent processing time: %f sec\n", elapsed);
+    palindromes = results[HIT_PALINDROME];
+    semordnilaps = results[HIT_SEMORDNILAP];
+    for (int t = 0; t < omp_get_max_threads(); t++)
+    {
+        for (int k = 0; k < NUM_HITS; k++)
+        {
+            free(thread_hits[t].vectors[k].items);
+        }
+    }
+    free(thread_hits);
+    free(blocks);
+
+    // Return the elapsed time.
+    return end_time - start_time;
 }
 
 /// @brief Function used to print the results to a results.txt file.
@@ -241,6 +950,553 @@ void print_results()
     fclose(output_pointer);
 }
 
+/// @brief Function used to compare two lines for qsort and bsearch, in the order of strcmp like the sort of the lines.
+/// @param a The first line.
+/// @param b The second line.
+/// @return Less than, equal to or greater than 0 as the first line comes before, with or after the second.
+int compare_lines(const void *a, const void *b)
+{
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+/// @brief Function used to lowercase a line of the input like the loader does, and to write it to its shard. The shard is picked by the
+/// hash of the lesser of the word and its reverse, so a word and its reverse always end up in the same shard.
+/// @param text The line, lowercased in place.
+/// @param length The length of the line without its newline.
+/// @param outputs The shard files.
+/// @param shards The number of shards.
+/// @param scratch A buffer of at least length + 1 bytes for the reverse of the word.
+void shard_word(char *text, size_t length, FILE **outputs, int shards, char *scratch)
+{
+    // The word ends at a null character, as the lines of the arena do.
+    length = strnlen(text, length);
+    for (size_t i = 0; i < length; i++)
+    {
+        text[i] = (text[i] >= 'A' && text[i] <= 'Z') ? text[i] + ('a' - 'A') : text[i];
+    }
+
+    // The first character that differs from its mirror decides whether the word or its reverse comes first.
+    const char *key = text;
+    size_t i = 0;
+    while (i < length / 2 && text[i] == text[length - 1 - i])
+    {
+        i++;
+    }
+    if (i < length / 2 && (unsigned char)text[length - 1 - i] < (unsigned char)text[i])
+    {
+        reverse_word(scratch, text, length);
+        key = scratch;
+    }
+
+    FILE *output = outputs[hash_word(key, length) % shards];
+    fwrite(text, 1, length, output);
+    fputc('\n', output);
+}
+
+/// @brief Function used to split the input file into shards in one streaming pass. The file is read STREAMBUFFER bytes at a time, and
+/// only a line longer than the buffer makes it grow.
+/// @param path The path of the file.
+/// @param directory The directory of the shards.
+/// @param shards The number of shards.
+/// @return The number of words, or -1 if the file could not be read or a shard could not be written.
+long write_shards(const char *path, const char *directory, int shards)
+{
+    FILE *input = fopen(path, "rb");
+    if (input == NULL)
+    {
+        printf("Could not open file.\n");
+        return -1;
+    }
+
+    // Open every shard.
+    FILE **outputs = malloc(shards * sizeof(FILE *));
+    char shard_path[PATH_MAX];
+    int opened = 0;
+    for (; opened < shards; opened++)
+    {
+        snprintf(shard_path, sizeof(shard_path), "%s/shard-%d", directory, opened);
+        if ((outputs[opened] = fopen(shard_path, "w")) == NULL)
+        {
+            break;
+        }
+    }
+
+    size_t capacity = STREAMBUFFER, filled = 0;
+    char *buffer = malloc(capacity);
+    char *scratch = malloc(capacity + 1);
+    long count = 0;
+    while (opened == shards)
+    {
+        size_t got = fread(buffer + filled, 1, capacity - filled, input);
+        filled += got;
+
+        // Hand every complete line to its shard.
+        size_t begin = 0;
+        for (char *newline; (newline = memchr(buffer + begin, '\n', filled - begin)) != NULL; begin = newline - buffer + 1)
+        {
+            shard_word(buffer + begin, newline - buffer - begin, outputs, shards, scratch);
+            count++;
+        }
+
+        // At the end of the file the rest is a last line without a newline.
+        if (got == 0)
+        {
+            if (begin < filled)
+            {
+                shard_word(buffer + begin, filled - begin, outputs, shards, scratch);
+                count++;
+            }
+            break;
+        }
+
+        // Move the unfinished line to the front, and make room if it fills the whole buffer.
+        memmove(buffer, buffer + begin, filled - begin);
+        filled -= begin;
+        if (filled == capacity)
+        {
+            capacity *= 2;
+            buffer = realloc(buffer, capacity);
+            scratch = realloc(scratch, capacity + 1);
+        }
+    }
+
+    // Close the shards, a failed write shows up here at the latest.
+    int failed = (opened < shards) || ferror(input);
+    for (int s = 0; s < opened; s++)
+    {
+        failed |= (fclose(outputs[s]) != 0);
+    }
+    fclose(input);
+    free(outputs);
+    free(buffer);
+    free(scratch);
+
+    if (failed)
+    {
+        printf("Could not write the shards.\n");
+        return -1;
+    }
+    return count;
+}
+
+/// @brief Function used to find the palindromes and semordnilaps of one shard. The shard holds every word together with its reverse, so
+/// it is searched on its own: it is loaded, sorted, and its hits are written in sorted order to a file of palindromes and a file of
+/// semordnilaps, and the shard is removed.
+/// @param directory The directory of the shards.
+/// @param shard The number of the shard.
+/// @param palindromes_found The number of palindromes of the shard.
+/// @param semordnilaps_found The number of semordnilaps of the shard.
+/// @return 0 on success, 1 if the shard could not be read or its hits could not be written.
+int search_shard(const char *directory, int shard, int *palindromes_found, int *semordnilaps_found)
+{
+    char path[PATH_MAX];
+    struct stat file_stat;
+
+    // Load the shard.
+    snprintf(path, sizeof(path), "%s/shard-%d", directory, shard);
+    FILE *input = fopen(path, "rb");
+    if (input == NULL || fstat(fileno(input), &file_stat) != 0)
+    {
+        return 1;
+    }
+    size_t size = file_stat.st_size;
+    char *data = malloc(size + 1);
+    int failed = (fread(data, 1, size, input) != size);
+    fclose(input);
+    remove(path);
+
+    // Split it into lines, every one of them ends in a newline.
+    int count = count_newlines(data, size), longest = 0;
+    char **shard_lines = malloc((count + 1) * sizeof(char *));
+    char *line = data;
+    for (int i = 0; i < count; i++)
+    {
+        char *newline = memchr(line, '\n', data + size - line);
+        *newline = '\0';
+        shard_lines[i] = line;
+        if (newline - line > longest)
+        {
+            longest = newline - line;
+        }
+        line = newline + 1;
+    }
+    qsort(shard_lines, count, sizeof(char *), compare_lines);
+
+    // Search the sorted lines, which writes the hits in sorted order.
+    snprintf(path, sizeof(path), "%s/palindromes-%d", directory, shard);
+    FILE *palindrome_output = fopen(path, "w");
+    snprintf(path, sizeof(path), "%s/semordnilaps-%d", directory, shard);
+    FILE *semordnilap_output = fopen(path, "w");
+    char *reversed_line = malloc(longest + 1);
+    *palindromes_found = 0;
+    *semordnilaps_found = 0;
+    for (int i = 0; i < count && !failed && palindrome_output != NULL && semordnilap_output != NULL; i++)
+    {
+        int length = strlen(shard_lines[i]);
+        if (is_palindrome(shard_lines[i], length))
+        {
+            fprintf(palindrome_output, "%s\n", shard_lines[i]);
+            (*palindromes_found)++;
+            continue;
+        }
+
+        char *key = reversed_line;
+        reverse_word(reversed_line, shard_lines[i], length);
+        if (bsearch(&key, shard_lines, count, sizeof(char *), compare_lines) != NULL)
+        {
+            fprintf(semordnilap_output, "%s\n", shard_lines[i]);
+            (*semordnilaps_found)++;
+        }
+    }
+
+    failed |= (palindrome_output == NULL || fclose(palindrome_output) != 0);
+    failed |= (semordnilap_output == NULL || fclose(semordnilap_output) != 0);
+    free(reversed_line);
+    free(shard_lines);
+    free(data);
+    return failed;
+}
+
+/// @brief Function used to merge the sorted hit files of one kind from every shard into the results, a line at a time.
+/// @param output The results file.
+/// @param directory The directory of the shards.
+/// @param kind The kind of hits, which names the files.
+/// @param shards The number of shards.
+void merge_hits(FILE *output, const char *directory, const char *kind, int shards)
+{
+    char path[PATH_MAX];
+    FILE **inputs = malloc(shards * sizeof(FILE *));
+    char **heads = calloc(shards, sizeof(char *));
+    size_t *capacities = calloc(shards, sizeof(size_t));
+
+    // Read the first hit of every shard, without its newline. A shard without more hits has no head.
+    for (int s = 0; s < shards; s++)
+    {
+        snprintf(path, sizeof(path), "%s/%s-%d", directory, kind, s);
+        inputs[s] = fopen(path, "r");
+        ssize_t length = (inputs[s] != NULL) ? getline(&heads[s], &capacities[s], inputs[s]) : -1;
+        if (length > 0)
+        {
+            heads[s][length - 1] = '\0';
+        }
+        else
+        {
+            free(heads[s]);
+            heads[s] = NULL;
+        }
+    }
+
+    // Write the least head and read the next hit of its shard, until no shard has hits left.
+    for (;;)
+    {
+        int least = -1;
+        for (int s = 0; s < shards; s++)
+        {
+            if (heads[s] != NULL && (least < 0 || strcmp(heads[s], heads[least]) < 0))
+            {
+                least = s;
+            }
+        }
+        if (least < 0)
+        {
+            break;
+        }
+
+        fprintf(output, "%s\n", heads[least]);
+        ssize_t length = getline(&heads[least], &capacities[least], inputs[least]);
+        if (length > 0)
+        {
+            heads[least][length - 1] = '\0';
+        }
+        else
+        {
+            free(heads[least]);
+            heads[least] = NULL;
+        }
+    }
+
+    for (int s = 0; s < shards; s++)
+    {
+        if (inputs[s] != NULL)
+        {
+            fclose(inputs[s]);
+        }
+    }
+    free(inputs);
+    free(heads);
+    free(capacities);
+}
+
+/// @brief Function used to remove the files of the shards that are left, and their directory.
+/// @param directory The directory of the shards.
+/// @param shards The number of shards.
+void remove_shards(const char *directory, int shards)
+{
+    const char *kinds[] = {"shard", "palindromes", "semordnilaps"};
+    char path[PATH_MAX];
+
+    for (int k = 0; k < 3; k++)
+    {
+        for (int s = 0; s < shards; s++)
+        {
+            snprintf(path, sizeof(path), "%s/%s-%d", directory, kinds[k], s);
+            remove(path);
+        }
+    }
+    rmdir(directory);
+}
+
+/// @brief Function used to find the palindromes and semordnilaps of a file too large to load. The words are split into shards on disk in
+/// one streaming pass, the threads then search the shards in parallel, one shard each at a time, and the sorted hits of the shards are
+/// merged into the results. Memory holds one shard per thread, and the results are the same as those of the binary search.
+/// @param path The path of the file.
+/// @param shards The number of shards, or 0 for shards of about SHARDSIZE bytes.
+/// @return 0 on success, 1 on failure.
+int run_sharded(const char *path, int shards)
+{
+    struct stat file_stat;
+    if (stat(path, &file_stat) != 0)
+    {
+        printf("Could not open file.\n");
+        return 1;
+    }
+    if (shards == 0)
+    {
+        shards = file_stat.st_size / SHARDSIZE + 1;
+        shards = (shards < omp_get_max_threads()) ? omp_get_max_threads() : shards;
+    }
+    shards = (shards > SHARDMAX) ? SHARDMAX : shards;
+
+    // Keep the shards in a directory of their own under TMPDIR, which can point to a disk when /tmp is kept in memory.
+    char directory[PATH_MAX];
+    const char *temporary = getenv("TMPDIR");
+    snprintf(directory, sizeof(directory), "%s/palindrome-XXXXXX", (temporary != NULL) ? temporary : "/tmp");
+    if (mkdtemp(directory) == NULL)
+    {
+        printf("Could not create the shard directory.\n");
+        return 1;
+    }
+
+    // Split the words into the shards.
+    double start_time = omp_get_wtime();
+    long count = write_shards(path, directory, shards);
+    if (count <= 0)
+    {
+        if (count == 0)
+        {
+            printf("Input file is empty.\n");
+        }
+        remove_shards(directory, shards);
+        return 1;
+    }
+    printf("Number of words: %ld\n", count);
+    printf("Sharding time: %f sec\n", omp_get_wtime() - start_time);
+
+    // Search the shards, the threads take the next shard when they are done with one.
+    int failed = 0;
+    start_time = omp_get_wtime();
+    palindromes_count = 0;
+    semordnilaps_count = 0;
+    int bind_failed = 0;
+    #pragma omp parallel reduction(| : bind_failed)
+    {
+        bind_failed |= bind_thread();
+        #pragma omp for schedule(dynamic, 1) reduction(+ : palindromes_count, semordnilaps_count) reduction(| : failed)
+        for (int s = 0; s < shards; s++)
+        {
+            int shard_palindromes = 0, shard_semordnilaps = 0;
+            failed |= search_shard(directory, s, &shard_palindromes, &shard_semordnilaps);
+            palindromes_count += shard_palindromes;
+            semordnilaps_count += shard_semordnilaps;
+        }
+        bind_failed |= unbind_thread();
+    }
+    check_binding(bind_failed);
+    if (failed)
+    {
+        printf("Could not search the shards.\n");
+        remove_shards(directory, shards);
+        return 1;
+    }
+    printf("Concurrent processing time: %f sec\n", omp_get_wtime() - start_time);
+    printf("Palindromes count: %d\n", palindromes_count);
+    printf("Semordnilaps count: %d\n", semordnilaps_count);
+
+    // Merge the hits of the shards into the results, in the layout of print_results.
+    FILE *output_pointer = fopen("results.txt", "w+");
+    if (output_pointer == NULL)
+    {
+        printf("Could not open output file.\n");
+    }
+    else
+    {
+        fprintf(output_pointer, "Palindromes result:\n");
+        merge_hits(output_pointer, directory, "palindromes", shards);
+        fprintf(output_pointer, "\nSemordnilaps:\n");
+        merge_hits(output_pointer, directory, "semordnilaps", shards);
+        fclose(output_pointer);
+    }
+
+    remove_shards(directory, shards);
+    return 0;
+}
+
+/// @brief Function used to get a pseudo-random number from a seed with the SplitMix64 generator, so every word of the benchmark can be
+/// generated on its own by any thread.
+/// @param seed The seed.
+/// @return The pseudo-random number.
+uint64_t bench_random(uint64_t seed)
+{
+    seed += 0x9e3779b97f4a7c15ULL;
+    seed = (seed ^ (seed >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    seed = (seed ^ (seed >> 27)) * 0x94d049bb133111ebULL;
+    return seed ^ (seed >> 31);
+}
+
+/// @brief Function used to generate a dictionary for the benchmark in the arena, like read_lines would load it from a file. Word i is made
+/// of random lowercase letters drawn from seed i, except that every spacing-th word is the reverse of the word spacing - 1 places
+/// before it.
+/// @param count The number of words.
+/// @param spacing How often a word is the reverse of an earlier one.
+void generate_words(int count, int spacing)
+{
+    line_count = count;
+    words = malloc(line_count * sizeof(Word));
+    lines = malloc(line_count * sizeof(char *));
+
+    // Lay out the words one after another, each followed by a null character.
+    size_t size = 0;
+    for (int i = 0; i < line_count; i++)
+    {
+        int base = (i % spacing == spacing - 1) ? i - (spacing - 1) : i;
+        words[i].offset = size;
+        words[i].length = 1 + bench_random(base) % BENCHLENGTH;
+        size += words[i].length + 1;
+    }
+    arena = malloc(size);
+
+    #pragma omp parallel for
+    for (int i = 0; i < line_count; i++)
+    {
+        int reverse = (i % spacing == spacing - 1);
+        uint64_t state = bench_random(reverse ? i - (spacing - 1) : i);
+        char *text = arena + words[i].offset;
+
+        for (int k = 0; k < words[i].length; k++)
+        {
+            state = bench_random(state);
+            text[reverse ? words[i].length - 1 - k : k] = 'a' + state % 26;
+        }
+        text[words[i].length] = '\0';
+        lines[i] = text;
+    }
+}
+
+/// @brief Function used to compare the engines on sparse and dense generated dictionaries from BENCHMIN words up to a limit. For every
+/// engine it prints the time to prepare the lookups, which is the sort for the binary search and the build of the hash set, and the time
+/// of the search, which includes collecting the hits.
+/// @param max_words The size of the largest dictionary.
+void run_benchmark(long max_words)
+{
+    int spacings[] = {BENCHSPARSE, BENCHDENSE};
+    const char *densities[] = {"sparse", "dense"};
+
+    printf("%10s %8s %8s %11s %11s %14s %13s\n", "words", "hits", "engine", "setup (s)", "search (s)", "lookups/s", "semordnilaps");
+    for (long count = BENCHMIN; count <= max_words; count *= 10)
+    {
+        for (int d = 0; d < 2; d++)
+        {
+            generate_words(count, spacings[d]);
+            for (engine = 0; engine < NUM_ENGINES; engine++)
+            {
+                double start_time = omp_get_wtime();
+                if (engine == ENGINE_HASH)
+                {
+                    build_hash_set();
+                }
+                else
+                {
+                    sort_lines();
+                }
+                double setup = omp_get_wtime() - start_time;
+                double search = find_words();
+
+                printf("%10ld %8s %8s %11.3f %11.3f %14.0f %13d\n", count, densities[d], engine_names[engine], setup, search,
+                       count / search, semordnilaps_count);
+                free(palindromes);
+                free(semordnilaps);
+            }
+            free(hash_set);
+            free(arena);
+            free(words);
+            free(lines);
+        }
+    }
+}
+
+/// @brief Function used to run the search on the loaded dictionary for every schedule and for 1, 2, 4 and so on up to a number of
+/// threads, and to write the fastest time of every configuration to a CSV file. The speedup and the efficiency are against the static
+/// schedule on 1 thread.
+/// @param path The path of the CSV file.
+/// @param max_threads The largest number of threads.
+/// @param chunk The number of lines handed out at a time, as for set_schedule.
+/// @return 0 on success, 1 if the file could not be written.
+int run_sweep(const char *path, int max_threads, int chunk)
+{
+    FILE *csv = fopen(path, "w");
+    if (csv == NULL)
+    {
+        printf("Could not open sweep file: %s\n", path);
+        return 1;
+    }
+
+    fprintf(csv, "engine,schedule,chunk,bind,threads,time,speedup,efficiency\n");
+    printf("%8s %8s %11s %9s %11s\n", "schedule", "threads", "search (s)", "speedup", "efficiency");
+    double serial_time = 0;
+    for (int kind = 0; kind < NUM_SCHEDULES; kind++)
+    {
+        set_schedule(kind, chunk);
+        for (int threads = 1, last = 0; !last; threads *= 2)
+        {
+            // End on the largest number of threads even when it is not a power of two.
+            if (threads >= max_threads)
+            {
+                threads = max_threads;
+                last = 1;
+            }
+
+            omp_set_num_threads(threads);
+
+            // Keep the fastest of a few runs.
+            double best = 0;
+            for (int r = 0; r < SWEEPREPEATS; r++)
+            {
+                double elapsed = find_words();
+                if (r == 0 || elapsed < best)
+                {
+                    best = elapsed;
+                }
+                free(palindromes);
+                free(semordnilaps);
+            }
+
+            if (kind == SCHEDULE_STATIC && threads == 1)
+            {
+                serial_time = best;
+            }
+            double speedup = serial_time / best;
+            fprintf(csv, "%s,%s,%d,%s,%d,%f,%f,%f\n", engine_names[engine], schedule_names[kind], chunk, bind_names[bind], threads, best,
+                    speedup, speedup / threads);
+            printf("%8s %8d %11.3f %9.2f %11.2f\n", schedule_names[kind], threads, best, speedup, speedup / threads);
+        }
+    }
+
+    fclose(csv);
+    palindromes = NULL;
+    semordnilaps = NULL;
+    return 0;
+}
+
 /// @brief The main function of the program.
 /// @param argc The number of arguments.
 /// @param argv The arguments as an array of strings.
@@ -249,52 +1505,154 @@ int main(int argc, char *argv[])
 {
     // Default value for number of threads.
     int num_threads = 1;
+    long bench = 0;
+    ScheduleKind schedule = SCHEDULE_STATIC;
+    int chunk = 0;
+    const char *sweep = NULL;
+    int shards = -1;
+    int opt;
+
+    static struct option long_options[] = {
+        {"engine", required_argument, NULL, 'e'},
+        {"bench", optional_argument, NULL, 'b'},
+        {"schedule", required_argument, NULL, 's'},
+        {"bind", required_argument, NULL, 'p'},
+        {"sweep", optional_argument, NULL, 'w'},
+        {"shards", optional_argument, NULL, 'k'},
+        {NULL, 0, NULL, 0}};
 
-    // Check if all the correct arguments are provided.
-    if (argc < 3)
+    // Remember the CPUs the program may run on before any thread is pinned.
+    sched_getaffinity(0, sizeof(allowed_cpus), &allowed_cpus);
+
+    // Read the options.
+    while ((opt = getopt_long(argc, argv, "e:b::s:p:w::k::", long_options, NULL)) != -1)
+    {
+        switch (opt)
+        {
+        case 'e':
+            for (engine = 0; engine < NUM_ENGINES && strcmp(optarg, engine_names[engine]) != 0; engine++)
+                ;
+            if (engine == NUM_ENGINES)
+            {
+                printf("Unknown engine: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'b':
+            bench = (optarg != NULL) ? atol(optarg) : BENCHMAX;
+            break;
+        case 's':
+        {
+            // The schedule may be followed by a chunk size in lines, as in dynamic,4096.
+            char *comma = strchr(optarg, ',');
+            size_t length = (comma != NULL) ? (size_t)(comma - optarg) : strlen(optarg);
+            for (schedule = 0; schedule < NUM_SCHEDULES && (strlen(schedule_names[schedule]) != length ||
+                                                            strncmp(optarg, schedule_names[schedule], length) != 0);
+                 schedule++)
+                ;
+            if (schedule == NUM_SCHEDULES)
+            {
+                printf("Unknown schedule: %s\n", optarg);
+                return 1;
+            }
+            chunk = (comma != NULL) ? atoi(comma + 1) : 0;
+            if (chunk < 0)
+            {
+                chunk = 0;
+            }
+            break;
+        }
+        case 'p':
+            for (bind = 0; bind < NUM_BINDS && strcmp(optarg, bind_names[bind]) != 0; bind++)
+                ;
+            if (bind == NUM_BINDS)
+            {
+                printf("Unknown binding: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'w':
+            sweep = (optarg != NULL) ? optarg : "sweep.csv";
+            break;
+        case 'k':
+            // Without a count, or with 0, the size of the file sets the number of shards.
+            shards = (optarg != NULL) ? atoi(optarg) : 0;
+            if (shards < 0)
+            {
+                shards = 0;
+            }
+            break;
+        default:
+            printf("Usage: %s [-e binary|hash] [-s static|dynamic|guided[,chunk]] [-p none|close|spread] file threads\n"
+                   "       %s [-e binary|hash] [-s kind[,chunk]] [-p none|close|spread] --sweep[=csv file] file max threads\n"
+                   "       %s [-p none|close|spread] --shards[=count] file threads\n"
+                   "       %s --bench[=max words] threads\n",
+                   argv[0], argv[0], argv[0], argv[0]);
+            return 1;
+        }
+    }
+
+    // Check if all the correct arguments are provided, the benchmark takes no file.
+    if (argc - optind < (bench > 0 ? 1 : 2))
     {
         printf("Missing arguments. %d\n", argc);
         return 1;
     }
 
     // Parse the number of threads from the arguments.
-    num_threads = atoi(argv[2]);
+    num_threads = atoi(argv[argc - 1]);
 
     // Ensure that we have at least 1 thread.
     if (num_threads < 1)
         num_threads = 1;
 
-    // Set the number of threads.
+    // Set the number of threads and the schedule of the search, the threads of the search pin themselves.
     omp_set_num_threads(num_threads);
+    set_schedule(schedule, chunk);
 
-    // Open the file of words that we received as an argument.
-    file_pointer = fopen(argv[1], "r");
-    if (file_pointer == NULL)
+    if (bench > 0)
     {
-        printf("Could not open file.\n");
-        return 1;
+        run_benchmark(bench);
+        return 0;
     }
 
-    // Check so that the file is not empty.
-    fseek(file_pointer, 0, SEEK_END);
-    if (ftell(file_pointer) == 0)
+    // Stream the file through shards on disk instead of loading it if asked to.
+    if (shards >= 0)
     {
-        printf("Input file is empty.\n");
-        return 1;
+        return run_sharded(argv[optind], shards);
     }
 
-    // Return to the start of the file.
-    fseek(file_pointer, 0, SEEK_SET);
+    // Read the words from the file of words that we received as an argument.
+    if (read_lines(argv[optind]) != 0)
+    {
+        return 1;
+    }
 
-    // Read the words from the same file and ensure that they are sorted.
-    read_lines();
-    sort_lines();
+    // Prepare the lookups: the binary search needs the words sorted, the hash set is built over the arena as it is.
+    double start_time = omp_get_wtime();
+    if (engine == ENGINE_HASH)
+    {
+        build_hash_set();
+    }
+    else
+    {
+        sort_lines();
+    }
+    printf("%s time: %f sec\n", (engine == ENGINE_HASH) ? "Hash set build" : "Sorting", omp_get_wtime() - start_time);
 
-    // Close the file.
-    fclose(file_pointer);
+    // Sweep the schedules and numbers of threads instead of a single search if asked to.
+    if (sweep != NULL)
+    {
+        int status = run_sweep(sweep, num_threads, chunk);
+        free(hash_set);
+        free(arena);
+        free(words);
+        free(lines);
+        return status;
+    }
 
-    // Call find_words to find the palindromes and semordnilaps.
-    find_words();
+    // Call find_words to find the palindromes and semordnilaps, and print the elapsed time.
+    printf("Concurrent processing time: %f sec\n", find_words());
 
     // Print counts
     printf("Palindromes count: %d\n", palindromes_count);
@@ -303,11 +1661,10 @@ int main(int argc, char *argv[])
     // Print the results to the output file.
     print_results();
 
-    // Free the memory of the arrays.
-    for (int i = 0; i < line_count; i++)
-    {
-        free(lines[i]);
-    }
+    // Free the memory of the arena and the arrays.
+    free(hash_set);
+    free(arena);
+    free(words);
     free(lines);
     free(palindromes);
     free(semordnilaps);